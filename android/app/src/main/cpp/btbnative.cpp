@@ -1,15 +1,97 @@
 #include <stdint.h>
 #include <jni.h>
+#include <mutex>
 
-static int rc = 0;
+#include "btbbridge.h"
+
+// the android app's protocol, on the same core as the linux cli. AppLogic's scan, input and timer
+// threads all call in, so each node is behind a lock. buffers are direct ByteBuffers, see btbbridge.h
+// for what's in them. there is no destroy: AppLogic makes one node per process and keeps it, as the
+// threads using it may outlive an activity.
+
+struct nativenode {
+    btbnode node;
+    std::mutex lock;
+};
+
+static nativenode* handle_node(jlong h) { return reinterpret_cast<nativenode*>(h); }
 
 extern "C"
 {
 
+JNIEXPORT jlong JNICALL
+Java_com_orthopteroid_btbchat_AppLogic_nativeCreate(JNIEnv *env, jobject obj)
+{
+    nativenode* n = new nativenode;
+    n->node.meshmode = 1;
+    return reinterpret_cast<jlong>(n);
+}
+
 JNIEXPORT void JNICALL
-Java_com_orthopteroid_btbchat_MainActivity_nativeTest(JNIEnv *env, jobject obj)
+Java_com_orthopteroid_btbchat_AppLogic_nativeConfigure(JNIEnv *env, jobject obj, jlong h, jint privcode, jint mfgcode, jboolean meshmode, jboolean adaptive)
 {
-    rc = 0;
+    nativenode* n = handle_node(h);
+    std::lock_guard<std::mutex> guard(n->lock);
+    n->node.privcode = (uint8_t)privcode;
+    n->node.mfgcode = (uint16_t)mfgcode;
+    n->node.meshmode = meshmode ? 1 : 0;
+    n->node.air.adaptive = adaptive;
 }
 
-}
\ No newline at end of file
+// queue typed text, fragmented as needed. returns the chars sent
+JNIEXPORT jint JNICALL
+Java_com_orthopteroid_btbchat_AppLogic_nativeSendText(JNIEnv *env, jobject obj, jlong h, jstring text)
+{
+    nativenode* n = handle_node(h);
+    const char* s = env->GetStringUTFChars(text, nullptr);
+    if (!s) return 0;
+    int sent;
+    {
+        std::lock_guard<std::mutex> guard(n->lock);
+        sent = n->node.send_text(s, (int)strlen(s));
+    }
+    env->ReleaseStringUTFChars(text, s);
+    return sent;
+}
+
+// a batch of scan records in, from offset, the messages they complete out. returns <bytes of in consumed> << 32 | <bytes written to out>
+JNIEXPORT jlong JNICALL
+Java_com_orthopteroid_btbchat_AppLogic_nativeReceive(JNIEnv *env, jobject obj, jlong h, jobject in, jint offset, jint inlen, jobject out)
+{
+    nativenode* n = handle_node(h);
+    const uint8_t* inbuf = (const uint8_t*)env->GetDirectBufferAddress(in);
+    uint8_t* outbuf = (uint8_t*)env->GetDirectBufferAddress(out);
+    if (!inbuf || !outbuf) return 0;
+    // offset and inlen come from kotlin, keep them inside the buffer
+    jlong incap = env->GetDirectBufferCapacity(in);
+    if (offset < 0 || inlen < 0 || (jlong)offset + inlen > incap) return 0;
+    size_t outlen;
+    size_t used;
+    {
+        std::lock_guard<std::mutex> guard(n->lock);
+        used = bridge_receive(n->node, inbuf + offset, (size_t)inlen, outbuf, (size_t)env->GetDirectBufferCapacity(out), outlen);
+    }
+    return ((jlong)used << 32) | (jlong)outlen;
+}
+
+// pick the next beacon into payload. returns ms to hold it, 0 when there's nothing to send
+JNIEXPORT jint JNICALL
+Java_com_orthopteroid_btbchat_AppLogic_nativePick(JNIEnv *env, jobject obj, jlong h, jint minute, jobject payload)
+{
+    nativenode* n = handle_node(h);
+    uint8_t* buf = (uint8_t*)env->GetDirectBufferAddress(payload);
+    if (!buf || env->GetDirectBufferCapacity(payload) < bridge_payload_size) return 0;
+    std::lock_guard<std::mutex> guard(n->lock);
+    return bridge_pick(n->node, (uint8_t)minute, buf);
+}
+
+// beacon timer jitter, ms
+JNIEXPORT jint JNICALL
+Java_com_orthopteroid_btbchat_AppLogic_nativeJitter(JNIEnv *env, jobject obj, jlong h)
+{
+    nativenode* n = handle_node(h);
+    std::lock_guard<std::mutex> guard(n->lock);
+    return (jint)n->node.air.jitter();
+}
+
+}
@@ -35,6 +35,8 @@ class MainActivity : AppCompatActivity() {
     private var mAdapter: BluetoothAdapter? = null
     private var mAdvertiseCallback: AdvertiseCallback? = null
     private var mAdvertiseSettings: AdvertiseSettings? = null
+    private var mScanSettings: ScanSettings? = null
+    private var mScanCallback: ScanCallback? = null
     private var mAppLogic: AppLogic? = null
 
     fun failAndQuit(msg: String) {
@@ -115,10 +117,7 @@ class MainActivity : AppCompatActivity() {
         ssb.setScanMode(ScanSettings.SCAN_MODE_LOW_LATENCY)
         ssb.setMatchMode(ScanSettings.CALLBACK_TYPE_ALL_MATCHES) // api 26+
         ssb.setCallbackType(ScanSettings.CALLBACK_TYPE_ALL_MATCHES) // api 23+
-
-        // set scan filter here, if we were to do this.
-        // but we're not going to because we're going to allow the app to change the mfgcode
-        // https://github.com/AltBeacon/android-beacon-library/blob/master/lib/src/main/java/org/altbeacon/beacon/service/scanner/ScanFilterUtils.java
+        mScanSettings = ssb.build()
 
         ///////////////
 
@@ -147,17 +146,28 @@ class MainActivity : AppCompatActivity() {
             }
         })
 
-        mAdapter?.bluetoothLeScanner?.startScan(
-            object : ScanCallback() {
-                override fun onScanResult(callbackType: Int, result: ScanResult) {
-                    mAppLogic?.mNetworkBytes?.addLast(result.scanRecord!!.bytes)
-                }
-                //override fun onBatchScanResults(results: List<ScanResult?>?) {}
-                override fun onScanFailed(errorCode: Int) {
-                    if(mAppLogic!!.debugmode) Log.e(TAG, "Scan start failed")
-                }
+        mScanCallback = object : ScanCallback() {
+            override fun onScanResult(callbackType: Int, result: ScanResult) {
+                mAppLogic?.mScanBatch?.add(result)
+            }
+            //override fun onBatchScanResults(results: List<ScanResult?>?) {}
+            override fun onScanFailed(errorCode: Int) {
+                if(mAppLogic!!.debugmode) Log.e(TAG, "Scan start failed")
             }
-        )
+        }
+        startScan(mAppLogic!!.mfgcode)
+    }
+
+    // (re)start the scan for beacons under mfgcode. the filter is on the manufacturer data, which most
+    // phones hand to the controller so other advertisements never wake the app
+    // https://github.com/AltBeacon/android-beacon-library/blob/master/lib/src/main/java/org/altbeacon/beacon/service/scanner/ScanFilterUtils.java
+    public fun startScan(mfgcode: Short) {
+        val scanner = mAdapter?.bluetoothLeScanner ?: return
+        val callback = mScanCallback ?: return
+        scanner.stopScan(callback)
+        val beaconcode = byteArrayOf(0xBE.toByte(), 0xAC.toByte())
+        val filter = ScanFilter.Builder().setManufacturerData(mfgcode.toInt() and 0xFFFF, beaconcode).build()
+        scanner.startScan(listOf(filter), mScanSettings, callback)
     }
 
     ///////////////////
@@ -0,0 +1,55 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "airtime.h"
+
+// add to a set, true if it wasn't there. 0 stands for empty, so keys are forced odd
+static bool set_add(uint32_t* set, uint32_t key)
+{
+    key |= 1;
+    for (uint32_t i = (key * 0x9E3779B1u) >> 23;; i = (i + 1) % airtime::table_size) {
+        if (set[i] == key) return false;
+        if (!set[i]) { set[i] = key; return true; }
+    }
+}
+
+void airtime::hear(const uint32_t pakhash, const uint32_t sender, const int8_t rssi)
+{
+    heard++;
+    if (set_add(packet_set, pakhash)) packets++;
+    if (set_add(pair_set, pakhash ^ (sender * 0x85EBCA6Bu))) pairs++;
+    rssi_mean += (rssi - rssi_mean) / 16;
+    rssi_dev += (fabs(rssi - rssi_mean) - rssi_dev) / 16;
+    if (heard >= window) update();
+}
+
+// a thin window counts for less
+void airtime::update()
+{
+    double w = 0.25 * std::min(1.0, (double)heard / window);
+    copies += w * ((double)pairs / std::max((uint32_t)1, packets) - copies);
+    heard = packets = pairs = 0;
+    memset(packet_set, 0, sizeof(packet_set));
+    memset(pair_set, 0, sizeof(pair_set));
+}
+
+int airtime::hold(const int xtime) const
+{
+    if (!adaptive) return xtime;
+    return (int)(xtime * std::min(1.0, std::max(0.5, sqrt(target / copies))));
+}
+
+double airtime::forward_chance(const int8_t rssi) const
+{
+    if (!adaptive) return 1;
+    double spread = std::max(1.0, rssi_dev);
+    double far = std::min(1.0, std::max(-1.0, (rssi_mean - rssi) / spread)); // +1 weak, -1 strong
+    return std::min(1.0, std::max(0.25, target / copies) * (1 + 0.5 * far));
+}
+
+uint airtime::jitter() const
+{
+    if (!adaptive) return base_jitter;
+    return (uint)(base_jitter * std::min(4.0, std::max(1.0, copies / target)));
+}
@@ -0,0 +1,44 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include <cstdint>
+#include <sys/types.h>
+
+// adaptive airtime. estimates how crowded the channel is from the receive stream and scales the mesh
+// beacon hold, the chance a new packet is forwarded at all and the beacon timer jitter to suit.
+// the density estimate is copies: distinct senders heard per distinct packet, i.e. how many neighbours
+// typically rebroadcast each one. a held beacon repeats every adv interval, so repeats from one sender
+// count once. forwarding less lowers what neighbours hear, so the forward chance settles where about
+// target copies reach each node, rather than every node rebroadcasting everything.
+// rssi spread picks who forwards: packets heard weakly come from further away, so we add more
+// coverage rebroadcasting them than a neighbour that heard them strongly would.
+struct airtime {
+    static constexpr double target = 3; // copies of a packet worth hearing
+    static constexpr uint32_t window = 256; // packets heard per estimate update, or a minute, whichever is first
+    static constexpr uint32_t table_size = 512; // open addressed sets of this window's packets and packet/sender pairs
+    static constexpr uint base_jitter = 250; // ms, the fixed jitter on beacon timers
+
+    bool adaptive = false; // off: fixed holds, always forward, fixed jitter
+    double copies = 1; // smoothed senders heard per distinct packet, 1 until we know better
+    double rssi_mean = -70, rssi_dev = 8; // smoothed, of packets heard
+
+    uint32_t heard = 0, packets = 0, pairs = 0; // this window
+    uint32_t packet_set[table_size] = {0}, pair_set[table_size] = {0};
+
+    // every packet that passed the minute test, new or not, with the low bytes of its sender's address
+    void hear(const uint32_t pakhash, const uint32_t sender, const int8_t rssi);
+    // on minute rollover, so a quiet channel still gets a fresh estimate
+    void tick() { if (heard) update(); }
+
+    // mesh hold for a packet, from its fixed hold. shorter on a crowded channel, where others repeat it too
+    int hold(const int xtime) const;
+    // chance a new packet heard at this rssi is worth forwarding
+    double forward_chance(const int8_t rssi) const;
+    // ms of random delay to add to a beacon timer, wider on a crowded channel to keep neighbours apart
+    uint jitter() const;
+
+private:
+    void update();
+};
+
+#endif //AIRTIME_H
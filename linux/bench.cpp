@@ -0,0 +1,282 @@
+// btbchat_bench: times the protocol's hot kernels in isolation, with synthetic inputs or frames from a
+// capture file, and prints one json object per line so results can be diffed release to release:
+//   {"bench":"crc32","param":20,"build":"Release","iters":1048576,"ns_per_op":12.3,"ns_per_op_min":12.1}
+// each bench is calibrated to run for about -m ms, then repeated and the median and best reported.
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "btbnode.h"
+#include "btbcmd.h"
+#include "btbbridge.h"
+#include "simradio.h"
+#include "hcicap.h"
+
+// cmake's build type, as numbers from different ones don't compare
+#ifndef BENCH_BUILD
+#define BENCH_BUILD ""
+#endif
+
+static double target_ms = 50;
+static int reps = 5;
+static const char* filter = nullptr;
+static FILE* out = stdout;
+
+static volatile uint64_t sink; // keeps results alive
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// run op(i) for i in [0, iters), calibrating iters first. param is the bench's size knob, for the record.
+// an op that does per_call units of work, like a batch, is reported per unit
+static void bench(const char* name, const long param, const std::function<void(uint64_t)>& op, const int per_call = 1)
+{
+    if (filter && !strstr(name, filter)) return;
+
+    auto run = [&op](uint64_t iters) {
+        double t0 = now_ns();
+        for (uint64_t i = 0; i < iters; i++) op(i);
+        return now_ns() - t0;
+    };
+    uint64_t iters = 1;
+    double ns;
+    while ((ns = run(iters)) < target_ms * 1e6 / 8 && iters < ((uint64_t)1 << 40)) iters *= 2;
+    ns = std::min(ns, run(iters)); // a second look, in case the first was preempted
+    iters = std::max((uint64_t)1, (uint64_t)(iters * target_ms * 1e6 / std::max(ns, 1.0)));
+
+    std::vector<double> per_op;
+    for (int r = 0; r < reps; r++) per_op.push_back(run(iters) / iters / per_call);
+    std::sort(per_op.begin(), per_op.end());
+    fprintf(out, "{\"bench\":\"%s\",\"param\":%ld,\"build\":\"%s\",\"iters\":%lu,\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f}\n",
+        name, param, BENCH_BUILD, (unsigned long)iters, per_op[per_op.size() / 2], per_op[0]);
+    fflush(out);
+}
+
+//////////////////
+
+// le advertising report frames: our beacons, with some from another mfgcode mixed in
+static std::vector<simradio::frame> canned_frames(const int n, const uint16_t mfgcode)
+{
+    simradio radio;
+    uint8_t addr[6] = {1, 2, 3, 4, 5, 6};
+    for (int i = 0; i < n; i++) {
+        char text[apppacket::text_max + 1];
+        int len = snprintf(text, sizeof(text), "bench message %d", i);
+        txablepacket tx;
+        tx.parse_text(0, 0, text, len);
+        uint8_t advbuf[apppacket::adv_size];
+        tx.build_beacon(advbuf, i % 8 ? mfgcode : mfgcode + 1);
+        radio.hear(advbuf, addr, (int8_t)(-40 - i % 50));
+    }
+    return std::vector<simradio::frame>(radio.inbox.begin(), radio.inbox.end());
+}
+
+// every record of a capture file, as frames
+static std::vector<std::vector<uint8_t>> capture_frames(const char* path)
+{
+    std::vector<std::vector<uint8_t>> frames;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) return frames;
+    size_t size = st.st_size;
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return frames;
+    const uint8_t* data = (const uint8_t*)p;
+    if (size >= sizeof(hcicap_header) && !memcmp(data, hcicap_magic, sizeof(hcicap_magic))) {
+        size_t pos = sizeof(hcicap_header);
+        hcicap_rec rec;
+        while (pos + sizeof(rec) <= size) {
+            memcpy(&rec, data + pos, sizeof(rec));
+            if (pos + sizeof(rec) + rec.len > size) break;
+            std::vector<uint8_t> f(256, 0);
+            memcpy(f.data(), data + pos + sizeof(rec), std::min((size_t)rec.len, f.size()));
+            frames.push_back(f);
+            pos += sizeof(rec) + rec.len;
+        }
+    }
+    munmap(p, size);
+    return frames;
+}
+
+//////////////////
+
+static void bench_crc()
+{
+    uint8_t buf[apppacket::pak_size];
+    for (int i = 0; i < (int)sizeof(buf); i++) buf[i] = (uint8_t)(i * 37);
+    const char* text = "the quick brown fox jump"; // text_max chars
+    bench("crc8", apppacket::text_max, [&](uint64_t i) { sink += crc8(text + (i & 1), apppacket::text_max - 1); });
+    bench("crc32", apppacket::pak_size, [&](uint64_t i) { buf[0] = (uint8_t)i; sink += crc32(buf, sizeof(buf)); });
+}
+
+static void bench_parse_network(const char* capture)
+{
+    const uint16_t mfgcode = 0x1122;
+    apppacket packet;
+    auto canned = canned_frames(1024, mfgcode);
+    bench("parse_network", (long)canned.size(), [&](uint64_t i) { sink += packet.parse_network(canned[i % canned.size()].data(), mfgcode); });
+
+    // the android bridge's path: batches of scan records through the receive path. per record
+    const int batch = 64;
+    std::vector<uint8_t> records(canned.size() * bridge_record_max);
+    size_t inlen = 0;
+    for (auto& f : canned) inlen += bridge_record(records.data() + inlen, f.data() + 14, f[13], f.data() + 7, (int8_t)f[14 + f[13]]);
+    std::vector<uint8_t> messages(batch * bridge_message_max);
+    btbnode bridged;
+    bridged.tick(0);
+    size_t pos = 0;
+    bench("bridge_receive", batch, [&](uint64_t) {
+        if (pos >= inlen) { pos = 0; bridged.dupl_clear(0); }
+        size_t end = pos, outlen;
+        for (int r = 0; r < batch && end < inlen; r++) end += 8 + records[end];
+        pos += bridge_receive(bridged, records.data() + pos, end - pos, messages.data(), messages.size(), outlen);
+        sink += outlen;
+    }, batch);
+
+    if (!capture) return;
+    auto recorded = capture_frames(capture);
+    if (recorded.empty()) { fprintf(stderr, "Can't read capture %s\n", capture); return; }
+    bench("parse_network_capture", (long)recorded.size(), [&](uint64_t i) { sink += packet.parse_network(recorded[i % recorded.size()].data(), mfgcode); });
+
+    // the whole receive path a frame takes, parse to take_text, with the capture's minute stamps
+    btbnode node;
+    node.meshmode = 1;
+    bench("receive_capture", (long)recorded.size(), [&](uint64_t i) {
+        const std::vector<uint8_t>& f = recorded[i % recorded.size()];
+        if (packet.parse_network(f.data(), node.mfgcode)) return;
+        node.tick(packet.minute());
+        if (node.receive(packet) != rx_ok) return;
+        char text[apppacket::msg_max + 1];
+        sink += node.take_text(packet, text, sizeof(text));
+    });
+}
+
+static void bench_dupl()
+{
+    btbnode node;
+    node.tick(0);
+    const uint32_t per_minute = 4096;
+    bench("dupl_mark", per_minute, [&](uint64_t i) { node.dupl_mark(0, (uint32_t)(i * 2654435761u)); });
+    bench("dupl_test", per_minute, [&](uint64_t i) { sink += node.dupl_test(0, (uint32_t)(i * 2654435761u)); });
+
+    // a minute's worth of marks between rollovers
+    uint8_t m = 0;
+    bench("dupl_tick", per_minute, [&](uint64_t i) {
+        if (i % per_minute == 0) { m = (m + 1) % 60; node.dupl_tick(m); }
+        node.dupl_mark(m, (uint32_t)(i * 2654435761u));
+    });
+}
+
+// journal records, written into the mapped file, and a restore of a full journal
+static void bench_journal()
+{
+    char path[] = "/tmp/btbjournalXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    ::close(fd);
+    journal j;
+    if (j.open(path) == 0) {
+        apppacket ap;
+        ap.parse_text(0, 0, "journal", 7);
+        pripacket pp(ap, TO_2SEC);
+        bench("journal_heard", 0, [&](uint64_t i) { j.heard(0, (uint32_t)(i * 2654435761u)); });
+        bench("journal_mesh", 0, [&](uint64_t) { j.mesh(0, pp); });
+        bench("journal_restore", journal::nrecs, [&](uint64_t) {
+            btbnode node;
+            j.restore(node, 0);
+            sink += node.meshpackets.size();
+        });
+    }
+    j.close();
+    unlink(path);
+}
+
+// pick from a mesh queue held at a steady depth: every picked packet is put back
+static void bench_pick()
+{
+    for (long depth : {10L, 100L, 1000L, 10000L, 100000L}) {
+        btbnode node;
+        node.meshmode = 1;
+        node.meshpackets.cap = (uint32_t)depth;
+        node.tick(0);
+        for (long i = 0; i < depth; i++) {
+            char text[apppacket::text_max + 1];
+            int len = snprintf(text, sizeof(text), "mesh %ld", i);
+            apppacket ap;
+            ap.parse_text(0, 0, text, len);
+            ap.rssi = (int8_t)(-30 - rnd() % 70);
+            node.meshpackets.insert(pripacket(ap, TO_2SEC));
+        }
+        txablepacket tx;
+        bench("pick_packet", depth, [&](uint64_t) {
+            if (!node.pick_packet(tx, 0)) return;
+            node.meshpackets.insert(pripacket(tx, TO_2SEC));
+        });
+    }
+}
+
+static void bench_parse_cmd()
+{
+    btbnode node;
+    const char* cmds[] = {"/mm 1", "/dm 0", "/pc secret", "/mc 1122", "/meshmode 0", "hello, not a command"};
+    const int ncmds = sizeof(cmds) / sizeof(cmds[0]);
+    apppacket packets[ncmds];
+    for (int c = 0; c < ncmds; c++) packets[c].parse_text(0, 0, cmds[c], (int)strlen(cmds[c]));
+    bench("parse_cmd", ncmds, [&](uint64_t i) { sink += parse_cmd(node, packets[i % ncmds]); });
+    debugmode = 0;
+}
+
+//////////////////
+
+static void usage()
+{
+    printf("btbchat_bench [ -r <capture file> ] [ -m <ms per run> ] [ -n <runs> ] [ -b <bench name filter> ] [ -o <results file> ]\n");
+    printf("  -r  also time parse_network and the receive path on a capture's frames\n");
+    printf("  -m  calibrate each run to about this long (%.0f)\n", target_ms);
+    printf("  -n  runs per bench, the median and best are reported (%d)\n", reps);
+    printf("  -b  only benches whose name contains this\n");
+    printf("  -o  append the json lines here instead of stdout\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* capture = nullptr;
+    debugmode = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:m:n:b:o:h")) != -1) {
+        switch (opt) {
+            case 'r': capture = optarg; break;
+            case 'm': target_ms = std::max(1.0, atof(optarg)); break;
+            case 'n': reps = std::max(1, atoi(optarg)); break;
+            case 'b': filter = optarg; break;
+            case 'o': if (!(out = fopen(optarg, "a"))) { printf("Can't open %s\n", optarg); return 1; } break;
+            default: usage(); return 1;
+        }
+    }
+
+    rnd.seed(1);
+    bench_crc();
+    bench_parse_network(capture);
+    bench_dupl();
+    bench_pick();
+    bench_journal();
+    bench_parse_cmd();
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
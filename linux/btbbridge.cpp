@@ -0,0 +1,67 @@
+#include <algorithm>
+
+#include "btbbridge.h"
+
+int bridge_record(uint8_t* in, const uint8_t* advdata, int len, const uint8_t* addr, const int8_t rssi)
+{
+    len = std::min(std::max(0, len), 31);
+    in[0] = (uint8_t)len;
+    in[1] = (uint8_t)rssi;
+    memcpy(in + 2, addr, 6);
+    memcpy(in + 8, advdata, len);
+    return 8 + len;
+}
+
+// an le meta advertising report around a scan record, laid out as parse_network expects:
+// <04> <3e> <plen> <02> <nreports> <evt type> <addr type> <addr x6> <data len> <data...> <rssi>
+static void record_frame(uint8_t* f, const uint8_t* rec)
+{
+    uint8_t len = std::min(rec[0], (uint8_t)31);
+    f[0] = hci_pkt_event;
+    f[1] = hci_evt_le_meta;
+    f[2] = (uint8_t)(12 + len);
+    f[3] = hci_le_adv_report;
+    f[4] = 1;
+    f[5] = 0x03; // ADV_NONCONN_IND
+    f[6] = 0x00; // public
+    memcpy(f + 7, rec + 2, 6);
+    f[13] = len;
+    memcpy(f + 14, rec + 8, len);
+    f[14 + len] = rec[1];
+    memset(f + 15 + len, 0, 31 - len); // parse_network may look past a short record
+}
+
+size_t bridge_receive(btbnode& node, const uint8_t* in, const size_t inlen, uint8_t* out, const size_t outsize, size_t& outlen)
+{
+    uint8_t frame[14 + 31 + 1];
+    char text[apppacket::msg_max + 1];
+    apppacket packet;
+    size_t pos = 0;
+    outlen = 0;
+    while (pos + 8 <= inlen && in[pos] <= 31 && pos + 8 + in[pos] <= inlen && outlen + bridge_message_max <= outsize) {
+        const uint8_t* rec = in + pos;
+        pos += 8 + rec[0];
+        record_frame(frame, rec);
+        if (packet.parse_network(frame, node.mfgcode)) continue;
+        if (node.receive(packet) != rx_ok) continue;
+        int len = node.take_text(packet, text, sizeof(text));
+        if (len < 0) continue;
+        put_le16((uint16_t)len, out + outlen);
+        out[outlen + 2] = packet.privcode();
+        out[outlen + 3] = (uint8_t)packet.rxrssi;
+        memcpy(out + outlen + 4, text, len);
+        outlen += 4 + len;
+    }
+    return pos;
+}
+
+int bridge_pick(btbnode& node, const uint8_t minute, uint8_t* payload)
+{
+    node.tick(minute);
+    txablepacket packet;
+    if (!node.pick_packet(packet, minute)) return 0;
+    uint8_t advbuf[apppacket::adv_size];
+    packet.build_beacon(advbuf, node.mfgcode);
+    memcpy(payload, advbuf + apppacket::adv_size - bridge_payload_size, bridge_payload_size);
+    return packet.xtime;
+}
@@ -0,0 +1,29 @@
+#ifndef BTBBRIDGE_H
+#define BTBBRIDGE_H
+
+#include "btbnode.h"
+
+// a flat, batched interface to a btbnode for hosts that can't share its structs, like the android app
+// over jni. a host hands over a batch of scan records in one call and gets back the messages they
+// completed, both as packed byte buffers, so nothing is allocated per packet on either side.
+//   scan record in:   <len> <rssi> <addr x6, lsb first> <advertising data, len bytes>
+//   message out:      <len le16> <privcode> <rssi> <text, len bytes>
+// rssi is as the host's scanner measured it, int8, in both.
+
+static constexpr int bridge_record_max = 2 + 6 + 31; // a legacy advertisement
+static constexpr int bridge_message_max = 4 + apppacket::msg_max;
+static constexpr int bridge_payload_size = apppacket::adv_size - 8; // after <len> <flags x3> <len> <ff> <mfgcode x2>
+
+// append one scan record to in, which has room for it. returns its size
+int bridge_record(uint8_t* in, const uint8_t* advdata, int len, const uint8_t* addr, const int8_t rssi);
+
+// run the records through the receive path, writing the messages they complete to out. stops early
+// when out can't take another whole message. returns the bytes of in consumed; outlen is set to those written
+size_t bridge_receive(btbnode& node, const uint8_t* in, const size_t inlen, uint8_t* out, const size_t outsize, size_t& outlen);
+
+// tick the node to this minute and pick a packet for the beacon. fills payload with the manufacturer
+// specific data to advertise under node.mfgcode, bridge_payload_size bytes, and returns how long to
+// hold it in ms. 0 when there's nothing to send
+int bridge_pick(btbnode& node, const uint8_t minute, uint8_t* payload);
+
+#endif //BTBBRIDGE_H
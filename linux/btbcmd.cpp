@@ -0,0 +1,68 @@
+#include <cstdio>
+
+#include "btbcmd.h"
+
+int parse_cmd(btbnode& node, const apppacket &ap)
+{
+    char cmdtext[apppacket::text_max +1];
+    ap.text(cmdtext);
+    if(*cmdtext!='/') return cmd_none; // skip cmd parsing when / prefix missing
+    unsigned int temp;
+
+    auto cmd_len = [](const char* s) { return ::text_len(s, apppacket::text_max); };
+    auto arg_len = [](const char* s) {
+        auto argoffset = ::text_len(s, apppacket::text_max -2) + 2; // +2 for start of arg
+        auto arglen = ::text_len(s +argoffset, apppacket::text_max -argoffset) +argoffset;
+        return arglen;
+    };
+    auto arg_start = [&cmdtext, cmd_len]() -> const char* {
+        auto argoffset = cmd_len(cmdtext) + 1; // +1 for start of arg
+        auto argstart = cmdtext + argoffset;
+        return argoffset < apppacket::text_max ? argstart : nullptr;
+    };
+
+    // a cmd token combines values that help ensure it is unique. ie: first two letters, length and crc8
+    auto cmdtoken = [](const char* s, const uint8_t len) -> uint { return (s[1]<<24) | (s[2]<<16) | (len<<(uint8_t)8) | crc8(s,len); };
+    auto strid = [cmdtoken](const char* s) -> uint { return cmdtoken(s,::text_len(s,apppacket::text_max)); };
+    auto cmdid = [&cmdtext, strid]() -> uint { return strid(cmdtext); };
+
+    const char* arg = arg_start();
+    switch( cmdid() )
+    {
+        case strid("/pc"):
+        case strid("/privcode"):
+            node.privcode = *arg ? crc8(arg, arg_len(arg)) : 0;
+            break;
+        case strid("/dm"):
+        case strid("/debugmode"):
+            debugmode = *arg ? *arg - '0' : 0;
+            break;
+        case strid("/mm"):
+        case strid("/meshmode"):
+            node.meshmode = *arg ? *arg - '0' : 0;
+            break;
+        case strid("/mc"):
+        case strid("/mfgcode"):
+            node.mfgcode = 0;
+            if(*arg) { sscanf(arg, "%4x", &temp); node.mfgcode = temp; }
+            break;
+        case strid("/st"):
+        case strid("/status"):
+            printf("privcode %02X debugmode %d meshmode %d mfgcode %02X\n",node.privcode,debugmode,node.meshmode,node.mfgcode);
+            break;
+        case strid("/sx"):
+        case strid("/stats"):
+            return cmd_stats;
+        case strid("/q"):
+        case strid("/quit"):
+            return cmd_quit;
+        case strid("/?"):
+            printf("[ /pc | /privcode ] <max24chartext>     [ /dm | /debugmode ] [0|1|2|3]\n");
+            printf("[ /mc | /mfgcode  ] <4hexdigits>        [ /mm | /meshmode  ] [0|1]\n");
+            printf("[ /sx | /stats ]                        [ /q  | /quit ]     [ /? ]\n");
+            break;
+        default:
+            return cmd_none;
+    }
+    return cmd_done;
+}
@@ -0,0 +1,12 @@
+#ifndef BTBCMD_H
+#define BTBCMD_H
+
+#include "btbnode.h"
+
+// what parse_cmd did. stats and quit are left to the app
+enum { cmd_none = 0, cmd_done, cmd_stats, cmd_quit };
+
+// run a /command typed into the chat against a node. cmd_none if the packet isn't one
+int parse_cmd(btbnode& node, const apppacket &ap);
+
+#endif //BTBCMD_H
@@ -0,0 +1,16 @@
+# the protocol core: packets, duplicate filter, mesh queue, logging. shared by the linux cli, the
+# simulator and the bench, and by the android app's native library (android/app/src/main/cpp)
+
+# log levels above this are compiled out: 1 status, 2 failures, 3 raw frame traces
+SET( BTB_LOG_MAX 3 CACHE STRING "highest log level compiled in" )
+
+find_package(Threads REQUIRED)
+
+set(BTBCORE_DIR ${CMAKE_CURRENT_LIST_DIR})
+add_library(btbcore STATIC
+    ${BTBCORE_DIR}/btbcore.cpp ${BTBCORE_DIR}/btbnode.cpp ${BTBCORE_DIR}/btbcmd.cpp ${BTBCORE_DIR}/btblog.cpp
+    ${BTBCORE_DIR}/btbbridge.cpp ${BTBCORE_DIR}/meshqueue.cpp ${BTBCORE_DIR}/meshstore.cpp ${BTBCORE_DIR}/srcqueue.cpp ${BTBCORE_DIR}/duplfilter.cpp
+    ${BTBCORE_DIR}/fragstore.cpp ${BTBCORE_DIR}/airtime.cpp ${BTBCORE_DIR}/journal.cpp ${BTBCORE_DIR}/metrics.cpp)
+target_include_directories(btbcore PUBLIC ${BTBCORE_DIR})
+target_compile_definitions(btbcore PUBLIC BTB_LOG_MAX=${BTB_LOG_MAX})
+target_link_libraries(btbcore Threads::Threads)
@@ -0,0 +1,224 @@
+#include "btbcore.h"
+
+int debugmode = DEFAULT_DEBUG_MODE;
+int textcoding = 1;
+
+std::random_device rnd_seed;
+std::default_random_engine rnd(rnd_seed());
+
+//////////////////
+
+// pack6 text coding: 6 bit symbols, 4 to every 3 bytes, so 18 bytes carry 24 symbols.
+// symbol 0 ends the text, 63 shifts the next letter to uppercase.
+static constexpr char pack6_chars[64 +1] =
+    "\0 abcdefghijklmnopqrstuvwxyz0123456789.,?!'\"-:;/#@()+=&*%$_<>[]";
+static constexpr uint8_t pack6_shift = 63;
+static constexpr uint8_t pack6_upper = 0x40; // in pack6_codes, needs a shift first
+static constexpr uint8_t pack6_none = 0xFF;
+
+struct pack6_table {
+    uint8_t codes[256];
+    constexpr pack6_table() : codes() {
+        for (int c = 0; c < 256; c++) codes[c] = pack6_none;
+        for (int s = 1; s < pack6_shift; s++) codes[(uint8_t)pack6_chars[s]] = (uint8_t)s;
+        for (int c = 'A'; c <= 'Z'; c++) codes[c] = pack6_upper | codes[c + ('a' - 'A')];
+    }
+};
+static constexpr pack6_table pack6;
+
+// symbols text needs up to its first nul, or -1 if a char can't be coded.
+// with fit, stops where nsym symbols or the codable chars run out and sets how many chars that was
+static int pack6_symbols(const char* text, int len, const int nsym, int* fit = nullptr)
+{
+    int n = 0, i = 0;
+    for (; i < len && text[i]; i++) {
+        uint8_t code = pack6.codes[(uint8_t)text[i]];
+        if (code == pack6_none) { if (fit) break; return -1; }
+        int w = (code & pack6_upper) ? 2 : 1;
+        if (fit && n + w > nsym) break;
+        n += w;
+    }
+    if (fit) *fit = i;
+    return n;
+}
+
+// code text into nsym symbols (a multiple of 4) at out. 0 on success, 1 if it doesn't fit
+static int pack6_encode(uint8_t* out, const int nsym, const char* text, int len)
+{
+    uint8_t sym[apppacket::text_max] = {0};
+    int n = 0;
+    for (int i = 0; i < len && text[i]; i++) {
+        uint8_t code = pack6.codes[(uint8_t)text[i]];
+        if (code == pack6_none) return 1;
+        if (n + ((code & pack6_upper) ? 2 : 1) > nsym) return 1;
+        if (code & pack6_upper) sym[n++] = pack6_shift;
+        sym[n++] = code & ~pack6_upper;
+    }
+    for (int g = 0; g < nsym / 4; g++) {
+        uint32_t v = (sym[4*g] << 18) | (sym[4*g+1] << 12) | (sym[4*g+2] << 6) | sym[4*g+3];
+        out[3*g+0] = (uint8_t)(v >> 16);
+        out[3*g+1] = (uint8_t)(v >> 8);
+        out[3*g+2] = (uint8_t)v;
+    }
+    return 0;
+}
+
+static int pack6_decode(char* buf, const uint8_t* in, const int nsym)
+{
+    int n = 0;
+    bool shift = false;
+    for (int g = 0; g < nsym / 4; g++) {
+        uint32_t v = (in[3*g] << 16) | (in[3*g+1] << 8) | in[3*g+2];
+        for (int s = 18; s >= 0; s -= 6) {
+            uint8_t sym = (v >> s) & 0x3F;
+            if (sym == 0) { buf[n] = 0; return n; }
+            if (sym == pack6_shift) { shift = true; continue; }
+            char c = pack6_chars[sym];
+            buf[n++] = shift && c >= 'a' && c <= 'z' ? (char)(c - ('a' - 'A')) : c;
+            shift = false;
+        }
+    }
+    buf[n] = 0;
+    return n;
+}
+
+// code text raw or pack6 into a region of bytes. returns the coding flag used
+static uint8_t code_text(uint8_t* out, const int bytes, const char* text, const int len)
+{
+    int nsym = bytes / 3 * 4;
+    int fit = 0;
+    if (textcoding && len > bytes) pack6_symbols(text, len, nsym, &fit);
+    if (fit > bytes && pack6_encode(out, nsym, text, fit) == 0) return apppacket::coding_pack6;
+    memcpy(out, text, std::min(len, bytes));
+    return apppacket::coding_raw;
+}
+
+static int decode_text(char* buf, const uint8_t* in, const int bytes, const uint8_t coding)
+{
+    if (coding == apppacket::coding_pack6) return pack6_decode(buf, in, bytes / 3 * 4);
+    memcpy(buf, in, bytes);
+    buf[bytes] = 0;
+    return (int)strlen(buf);
+}
+
+// how many leading chars of text code into a region of bytes
+static int fit_text(const char* text, const int len, const int bytes)
+{
+    int fit = 0;
+    if (textcoding) pack6_symbols(text, len, bytes / 3 * 4, &fit);
+    return std::max(fit, std::min(len, bytes));
+}
+
+int apppacket::text(char* buf) const
+{
+    if (fragment()) return decode_text(buf, pakdat + frag_offset, frag_size, coding());
+    return decode_text(buf, pakdat + text_offset, text_size, coding());
+}
+
+int apppacket::text_fit(const char* text, int len) { return fit_text(text, len, text_size); }
+int apppacket::frag_fit(const char* text, int len) { return fit_text(text, len, frag_size); }
+
+//////////////////
+
+void apppacket::parse_text(const uint8_t privcode, const uint8_t minute, const char* text, int len)
+{
+    memset(&pakdat, 0, sizeof(pakdat));
+    pakdat[0] = privcode;
+
+    // short text goes raw, so it reads the same on nodes that don't know the coding
+    pakdat[1] = minute | code_text(&pakdat[text_offset], text_size, text, std::max(0, len));
+    pakhash = crc32(pakdat, sizeof(pakdat));
+    rssi = 0xFF; // high priority, small -ve value
+}
+
+void apppacket::parse_fragment(const uint8_t privcode, const uint8_t minute, const uint16_t msgid, const uint8_t seq, const uint8_t count, const char* text, int len)
+{
+    memset(&pakdat, 0, sizeof(pakdat));
+    pakdat[0] = privcode;
+    put_le16(msgid, &pakdat[text_offset]);
+    pakdat[text_offset + 2] = (uint8_t)((seq << 4) | ((count - 1) & 0x0F));
+    pakdat[1] = minute | fragment_flag | code_text(&pakdat[frag_offset], frag_size, text, std::max(0, len));
+    pakhash = crc32(pakdat, sizeof(pakdat));
+    rssi = 0xFF; // high priority, small -ve value
+}
+
+int apppacket::parse_host(const uint8_t privcode, const uint8_t minute, char* text, size_t size, int fd)
+{
+    int len = read(fd, text, size - 1);
+    if (len <= 0) return -1; // closed
+    if(text[len - 1] == '\n') len--; // clean /n
+    text[len] = 0;
+    parse_text(privcode, minute, text, len);
+    return len;
+}
+
+int apppacket::parse_network(const uint8_t* hcibuf, const uint16_t mfgcode)
+{
+    // parse an hci packet and extract an advertisement body (if applicable). example:
+    // 043e28020102013a2d0161166d1c1bff0552beac2f234454cf6d4a0fadf2f4911ba9ffa600010003c500c2
+    //   ||          ||||||||||||  ||          ||                                          ||
+    //   META        BT ADDR       ADV LEN     ADV BODY                                    META RSSI
+    // ||  ||                    ||
+    // HCI META LEN              META DATA LEN
+
+    do {
+        uint16_t hciheader = get_le16(hcibuf);
+        if(hciheader != ((hci_evt_le_meta << 8) | hci_pkt_event)) statusmessage_break("Unknown HCI packet")
+
+        logframe(log_trace, "HCI packet in", hcibuf, hcibuf[2]);
+
+        // everything below is read from the report's data, whose lengths come over the air
+        const uint8_t datalen = hcibuf[13];
+        if (14 + datalen > 3 + hcibuf[2]) failmessage_break("Truncated advertising report")
+        const uint8_t* adv = hcibuf + 14;
+        const uint8_t* end = adv + datalen;
+
+        // android beacons start at the mfg structure, ours (and other stacks') lead with a flags structure
+        if (datalen >= 2 && adv[1] == 0x01) {
+            if (adv + 1 + adv[0] > end) failmessage_break("Bad flags structure")
+            adv += adv[0] + 1;
+        }
+        if (adv + 6 > end || adv[0] < 5 || adv + 1 + adv[0] > end) failmessage_break("Not a beacon")
+
+        if (get_le16(adv + 4) != 0xacbe) failmessage_break("Not a beacon")
+        if (get_le16(adv + 2) != mfgcode) failmessage_break("Not our beacon")
+
+        int applen = std::min((int)sizeof(pakdat), adv[0] - 5); // -5 for ff mm nn be ac header
+        logframe(log_trace, "App packet in", adv + 6, applen);
+
+        memset(pakdat, 0, sizeof(pakdat));
+        memcpy(pakdat, adv + 6, applen);
+        pakhash = crc32(pakdat, sizeof(pakdat));
+
+        rssi = 6 + applen <= adv[0] ? adv[6 + applen] : 0; // the byte after the packet, when the structure has one
+        sender = (uint32_t)get_le16(hcibuf + 7) | (uint32_t)get_le16(hcibuf + 9) << 16;
+        rxrssi = hcibuf[2] < 254 ? (int8_t)hcibuf[2 + hcibuf[2]] : 0; // the report's last byte, in a 256 byte buffer
+
+        logmessage(log_status, "App packet hash: %08X  rssi: %d", pakhash, (int)rssi);
+
+        return 0;
+    } while(false);
+
+    return 1;
+}
+
+// fills advbuf with adv_size bytes of advertising data, ready for the controller
+int apppacket::build_beacon(uint8_t* advbuf, const uint16_t mfgcode) const
+{
+    // outgoing packet example:
+    // 1F02011A1BFF2211BEAC001D343435353535350000000000000000000000FF00
+    const uint8_t advtemplate[] = {
+        0x1F,0x02,0x01,0x1A,0x1B,0xFF,0x22,0x11,0xBE,0xAC, // adv preamble mfgr: 0x1122
+        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00, // apppacket
+        negate(50),0x00 // fixed rssi and misc
+    };
+    static_assert(sizeof(advtemplate) == adv_size, "beacon template size");
+
+    memcpy(advbuf, advtemplate, sizeof(advtemplate));
+    memcpy(advbuf + app_offset, pakdat, sizeof(pakdat));
+    put_le16(mfgcode, advbuf + 6);
+
+    logframe(log_trace, "Beacon packet out", advbuf, advbuf[0] + 1); // +1 for len byte
+
+    return adv_size;
+}
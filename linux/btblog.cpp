@@ -0,0 +1,166 @@
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include <thread>
+
+#include "btbcore.h"
+
+// a bounded multi-producer ring (after Vyukov): each cell's sequence number says whether it is free
+// for the producer at that position or holds a record for the consumer. producers claim positions
+// with a CAS and never wait; a full ring drops the record.
+struct logring {
+    static constexpr size_t cells = 1024;
+
+    struct cell {
+        std::atomic<size_t> seq;
+        logrecord rec;
+    };
+
+    cell ring[cells];
+    alignas(64) std::atomic<size_t> head{0}; // next to write
+    alignas(64) std::atomic<size_t> tail{0}; // next to read, consumer only
+    std::atomic<uint64_t> dropped{0};
+
+    logring() { for (size_t i = 0; i < cells; i++) ring[i].seq.store(i, std::memory_order_relaxed); }
+
+    bool push(const logrecord& r) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            cell& c = ring[pos % cells];
+            intptr_t diff = (intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.rec = r;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(logrecord& r) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        cell& c = ring[pos % cells];
+        if ((intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1) < 0) return false;
+        r = c.rec;
+        c.seq.store(pos + cells, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+static logring log_ring;
+static std::thread log_thread;
+static std::atomic<bool> log_running{false};
+static std::atomic<bool> log_stop{false};
+static std::atomic<bool> log_sleeping{false}; // the log thread is, or is about to be, blocked on log_efd
+static int log_efd = -1;
+static FILE* log_out = stderr; // stdout is the chat, printed straight from the protocol thread
+
+static void log_write(const logrecord& r, FILE* f)
+{
+    char line[512];
+    switch (r.kind) {
+        case logrecord::k_text:
+            fprintf(f, "%.*s\n", (int)r.len, (const char*)r.blob);
+            break;
+        case logrecord::k_fmt:
+            r.format(line, sizeof(line), r.fmt, r.args);
+            fprintf(f, "%s\n", line);
+            break;
+        case logrecord::k_hex:
+            fprintf(f, "%s: %s\n", r.fmt, htoa(line, sizeof(line), r.blob, r.len));
+            break;
+    }
+}
+
+// drain, then block until a push finds the thread asleep and wakes it, so an idle log costs nothing.
+// sleeping is set before the last look at the ring and read after a push, both behind full fences,
+// so either the thread sees the record or the pusher sees it asleep
+static void log_loop()
+{
+    logrecord r;
+    uint64_t dropped = 0;
+    while (true) {
+        bool stopping = log_stop.load(std::memory_order_acquire);
+        int n = 0;
+        while (log_ring.pop(r)) { log_write(r, log_out); n++; }
+        uint64_t d = log_ring.dropped.load(std::memory_order_relaxed);
+        if (d != dropped) { fprintf(log_out, "Log ring full, %lu records dropped\n", (unsigned long)(d - dropped)); dropped = d; }
+        if (n) fflush(log_out);
+        if (stopping) break;
+
+        log_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (log_ring.pop(r)) { log_sleeping.store(false, std::memory_order_relaxed); log_write(r, log_out); continue; }
+        if (log_stop.load(std::memory_order_acquire)) continue;
+        uint64_t wakes;
+        ::read(log_efd, &wakes, sizeof(wakes));
+    }
+}
+
+int log_open(FILE* out)
+{
+    if (log_running) return 0;
+    log_out = out;
+    if (log_efd < 0 && (log_efd = eventfd(0, EFD_CLOEXEC)) < 0) return 1;
+    log_stop = false;
+    log_thread = std::thread(log_loop);
+    log_running = true;
+    return 0;
+}
+
+static void log_wake()
+{
+    uint64_t one = 1;
+    log_sleeping.store(false, std::memory_order_relaxed);
+    ::write(log_efd, &one, sizeof(one));
+}
+
+void log_close()
+{
+    if (!log_running) return;
+    log_stop.store(true, std::memory_order_release);
+    log_wake();
+    log_thread.join();
+    log_running = false;
+}
+
+uint64_t log_dropped()
+{
+    return log_ring.dropped.load(std::memory_order_relaxed);
+}
+
+void log_push(const logrecord& r)
+{
+    if (!log_running.load(std::memory_order_relaxed)) { log_write(r, log_out); return; }
+    log_ring.push(r);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (log_sleeping.load(std::memory_order_relaxed) && log_sleeping.exchange(false)) log_wake();
+}
+
+void log_text(const int level, const char* s)
+{
+    logrecord r;
+    r.level = (uint8_t)level;
+    r.kind = logrecord::k_text;
+    r.len = (uint8_t)strnlen(s, logrecord::blob_size);
+    memcpy(r.blob, s, r.len);
+    log_push(r);
+}
+
+void log_hex(const int level, const char* prefix, const void* data, const size_t len)
+{
+    logrecord r;
+    r.level = (uint8_t)level;
+    r.kind = logrecord::k_hex;
+    r.fmt = prefix;
+    r.len = (uint8_t)std::min(len, (size_t)logrecord::blob_size);
+    memcpy(r.blob, data, r.len);
+    log_push(r);
+}
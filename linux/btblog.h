@@ -0,0 +1,90 @@
+#ifndef BTBLOG_H
+#define BTBLOG_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+// logging. a call site costs a level test and, when it passes, copying its arguments into a binary
+// record on a lock-free ring; a log thread formats and prints the records. with no log thread running
+// (the simulator, the bench) records are formatted on the spot.
+//   statusmessage / failmessage    a string, copied
+//   logmessage(level, fmt, ...)    a static printf format and up to 6 numbers, formatted later. no strings
+//   logframe(level, prefix, data, len)   bytes, hex dumped later
+// a record shows when debugmode is at least its level. levels above BTB_LOG_MAX are compiled out.
+
+enum { log_status = 1, log_fail = 2, log_trace = 3 }; // trace is raw frames, in and out
+
+#ifndef BTB_LOG_MAX
+#define BTB_LOG_MAX 3
+#endif
+
+extern int debugmode;
+
+#define log_on(l) (BTB_LOG_MAX >= (l) && debugmode >= (l))
+#define logmessage(l, ...) if(log_on(l)) log_fmt((l), __VA_ARGS__);
+#define logframe(l, prefix, data, len) if(log_on(l)) log_hex((l), (prefix), (data), (len));
+
+struct logrecord {
+    static constexpr int max_args = 6;
+    static constexpr int blob_size = 96;
+    enum { k_text = 0, k_fmt, k_hex };
+
+    uint8_t level;
+    uint8_t kind;
+    uint8_t len; // of blob
+    const char* fmt; // k_fmt's format, k_hex's prefix. string literals only
+    int (*format)(char* buf, size_t size, const char* fmt, const uint64_t* args); // k_fmt, made for its argument types
+    uint64_t args[max_args];
+    uint8_t blob[blob_size]; // k_text's string, k_hex's bytes
+};
+
+// start the log thread, printing to out. 0 on success. not stdout, as the log thread's lines would land
+// out of order with what other threads print there
+int log_open(FILE* out = stderr);
+// print what's queued and stop it
+void log_close();
+// records lost to a full ring
+uint64_t log_dropped();
+
+void log_push(const logrecord& r);
+void log_text(const int level, const char* s);
+void log_hex(const int level, const char* prefix, const void* data, const size_t len);
+
+// an argument is kept as its bytes and turned back into its own type for snprintf
+template<class T>
+static inline T log_unpack(const uint64_t& a) { T v; memcpy(&v, &a, sizeof(T)); return v; }
+
+template<class... A, size_t... I>
+static int log_format_seq(char* buf, size_t size, const char* fmt, const uint64_t* args, std::index_sequence<I...>)
+{
+    return snprintf(buf, size, fmt, log_unpack<A>(args[I])...);
+}
+
+template<class... A>
+static int log_format(char* buf, size_t size, const char* fmt, const uint64_t* args)
+{
+    return log_format_seq<A...>(buf, size, fmt, args, std::index_sequence_for<A...>{});
+}
+
+template<class... A>
+void log_fmt(const int level, const char* fmt, const A... args)
+{
+    static_assert(sizeof...(A) <= logrecord::max_args, "too many log arguments");
+    // no pointers: the record is formatted later on the log thread, by when a string may have changed or gone
+    static_assert(std::conjunction<std::bool_constant<(std::is_arithmetic<A>::value || std::is_enum<A>::value) && sizeof(A) <= sizeof(uint64_t)>...>::value,
+        "log arguments are numbers, copy strings with log_text");
+    logrecord r;
+    r.level = (uint8_t)level;
+    r.kind = logrecord::k_fmt;
+    r.len = 0;
+    r.fmt = fmt;
+    r.format = &log_format<A...>;
+    uint64_t* a = r.args;
+    ((*a = 0, memcpy(a++, &args, sizeof(A))), ...);
+    log_push(r);
+}
+
+#endif //BTBLOG_H
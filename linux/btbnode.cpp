@@ -0,0 +1,82 @@
+#include <algorithm>
+
+#include "btbnode.h"
+
+int btbnode::send_text(const uint8_t priv, const char* text, int len)
+{
+    len = std::max(0, len);
+    if (apppacket::text_fit(text, len) >= len) {
+        apppacket packet;
+        packet.parse_text(priv, minute, text, len);
+        send(packet);
+        return len;
+    }
+
+    // cut into pieces first, the count goes in every fragment
+    int cut[apppacket::frag_max + 1] = {0};
+    int count = 0;
+    while (count < apppacket::frag_max && cut[count] < len) {
+        cut[count + 1] = cut[count] + std::max(1, apppacket::frag_fit(text + cut[count], len - cut[count]));
+        count++;
+    }
+
+    uint16_t msgid = (uint16_t)rnd();
+    for (int s = 0; s < count; s++) {
+        apppacket packet;
+        packet.parse_fragment(priv, minute, msgid, s, count, text + cut[s], cut[s + 1] - cut[s]);
+        send(packet);
+    }
+    return cut[count];
+}
+
+int btbnode::receive(const apppacket& packet)
+{
+    if (!packet.valid_minute(minute)) { statusmessage("Expired app packet") return tally(rx_expired); }
+    air.hear(packet.pakhash, packet.sender, packet.rxrssi);
+    if (dupl_test(minute, packet.pakhash)) { statusmessage("Duplicate app packet") return tally(rx_duplicate); }
+    dupl_mark(minute, packet.pakhash);
+    if (jnl) jnl->heard(minute, packet.pakhash);
+    // only messages we'll take are reassembled. others' fragments are tracked, so the mesh bump below
+    // goes to every unfinished message alike
+    bool keep = any_privcode || packet.valid_priv(privcode);
+    bool whole = !packet.fragment() || fragments.add(packet, keep);
+    if (meshmode && air.adaptive && std::uniform_real_distribution<double>(0, 1)(rnd) >= air.forward_chance(packet.rxrssi)) {
+        stats.suppressed++;
+    } else if (meshmode) {
+        pripacket pp(packet, TO_2SEC);
+        if (!whole) pp.priority = std::min(pp.priority + frag_bump, (uint)meshqueue::max_weight);
+        if (meshpackets.insert(pp) == 0) { stats.forwarded++; if (jnl) jnl->mesh(minute, pp); }
+    }
+    if (!packet.valid_priv(privcode)) { statusmessage("Squelched app packet") return tally(rx_squelched); }
+    if (!whole) return tally(rx_partial);
+    return tally(rx_ok);
+}
+
+int btbnode::take_text(const apppacket& packet, char* buf, size_t bufsize)
+{
+    if (packet.fragment()) return fragments.take(packet, buf, bufsize);
+    char text[apppacket::text_max + 1];
+    int len = std::min(packet.text(text), (int)bufsize - 1);
+    memcpy(buf, text, len);
+    buf[len] = 0;
+    return len;
+}
+
+bool btbnode::pick_packet(txablepacket &packet, const uint8_t m, const uint slot) {
+    // each pick with both queues waiting earns src src_share of a turn, and src goes when it's in credit.
+    // our own packets about to expire go regardless, as no one else will send them.
+    // the credit is settled by what was actually picked, as a turn's pick can come up empty
+    srcpackets.release(slot);
+    bool shared = !srcpackets.empty() && !meshpackets.empty() && !srcpackets.due(m);
+    bool src_turn = !shared || src_credit >= 0;
+
+    bool own = true;
+    if (src_turn && srcpackets.pick(packet, m, slot)) stats.pick_src++;
+    else if (meshpackets.pick(packet, m)) { packet.xtime = air.hold(packet.xtime); stats.pick_mesh++; own = false; }
+    else if (!src_turn && srcpackets.pick(packet, m, slot)) stats.pick_src++;
+    else { stats.pick_none++; return false; }
+    // at most a round's worth either way, so a stretch where one queue can't pick isn't paid back later
+    if (shared) src_credit = std::clamp(src_credit + (own ? src_share - 1 : src_share), src_share - 1, src_share);
+    if (jnl) jnl->picked(m, own, packet.pakhash);
+    return true;
+}
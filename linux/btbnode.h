@@ -0,0 +1,74 @@
+#ifndef BTBNODE_H
+#define BTBNODE_H
+
+#include "btbcore.h"
+#include "meshstore.h"
+#include "srcqueue.h"
+#include "duplfilter.h"
+#include "fragstore.h"
+#include "airtime.h"
+#include "journal.h"
+
+// receive path outcomes, in the order they are tested
+enum { rx_ok = 0, rx_expired, rx_duplicate, rx_squelched, rx_partial };
+
+// always-on protocol counters, exported by the cli's /stats and metrics file
+struct nodestats {
+    uint64_t rx[rx_partial + 1] = {0}; // by receive outcome
+    uint64_t forwarded = 0; // queued for the mesh
+    uint64_t suppressed = 0; // new packets adaptive airtime chose not to forward
+    uint64_t sent = 0; // src packets queued
+    uint64_t pick_src = 0; // pick_packet outcomes
+    uint64_t pick_mesh = 0;
+    uint64_t pick_none = 0;
+};
+
+// all per-node protocol state. the cli runs one of these, the simulator runs hundreds.
+struct btbnode {
+    int meshmode = 0;
+    uint8_t privcode = 0;
+    bool any_privcode = false; // reassemble every privcode's fragmented messages, not just ours, for a host serving others
+    uint16_t mfgcode = 0x1122;
+    uint8_t minute = 0xFF; // default, invalid
+    srcqueue srcpackets; // packets we are the source for
+    double src_share = 0.5; // of the picks when both queues have packets, see pick_packet
+    double src_credit = 0;
+    meshstore meshpackets; // mesh / forwardable packets
+    fragstore fragments; // messages being reassembled
+    airtime air; // channel density, and the holds, forwarding and jitter that suit it
+    nodestats stats;
+    journal* jnl = nullptr; // when set, what's heard, queued and picked is recorded for a warm restart
+
+    // mesh priority added to fragments of messages we haven't got all of, as neighbours likely haven't either
+    static constexpr uint frag_bump = 64;
+
+    // used to filter duplicate packets / packets we've seen within the last interval
+    // used to prevent packet looping in mesh mode
+    uint8_t dupl_minute = 0xFF; // invalid, by default
+    duplfilter dupl_table; // for current and next minute
+
+    void dupl_mark(const uint m, const uint32_t h) { dupl_table.mark(m, h); }
+    void dupl_clear(const uint m) { dupl_table.clear(m); }
+    bool dupl_test(const uint m, const uint32_t h) const { return dupl_table.test(m, h); }
+    void dupl_tick(const uint8_t m) { if(m != dupl_minute) { dupl_clear(dupl_minute); dupl_minute = m; } }  // on minute rollover, flush the dupl table
+
+    void tick(const uint8_t m) { minute = m; if (m != dupl_minute) { meshpackets.expire(m); fragments.expire(m); air.tick(); } dupl_tick(m); }
+    void send(const apppacket& ap) { srcpackets.push(ap, TO_3SEC); stats.sent++; if (jnl) jnl->src(minute, ap); }
+
+    // queue text as one packet, or as up to frag_max fragments when it's too long. returns the chars sent
+    int send_text(const char* text, int len) { return send_text(privcode, text, len); }
+    int send_text(const uint8_t priv, const char* text, int len);
+
+    // rx_ok when a whole message is ready for take_text, rx_partial for a fragment of an incomplete one
+    int receive(const apppacket& ap);
+    int take_text(const apppacket& ap, char* buf, size_t bufsize);
+
+    // the packet to put on the air in a beacon slot. src and mesh packets share the picks by src_share,
+    // except that src packets in their last minute go first
+    bool pick_packet(txablepacket &packet, const uint8_t m, const uint slot = 0);
+
+private:
+    int tally(const int rx) { stats.rx[rx]++; return rx; }
+};
+
+#endif //BTBNODE_H
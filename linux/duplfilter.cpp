@@ -0,0 +1,70 @@
+#include <cmath>
+#include <algorithm>
+
+#include "duplfilter.h"
+
+void duplfilter::configure(const uint32_t per_minute, const double fpr)
+{
+    // a generation holds two minutes of marks, this one's and the previous one's look-ahead.
+    // blocking costs some accuracy over a flat bloom filter, so give it a quarter more room.
+    double n = 2.0 * std::max((uint32_t)1, per_minute);
+    double p = std::min(0.5, std::max(1e-9, fpr));
+    double m = 1.25 * -n * log(p) / (M_LN2 * M_LN2);
+    nblocks = std::max((uint32_t)1, (uint32_t)ceil(m / block_bits));
+    k = std::min((uint32_t)16, std::max((uint32_t)1, (uint32_t)lround(m / n * M_LN2)));
+    for (int g = 0; g < 2; g++) {
+        bits[g].assign((size_t)nblocks * block_words, 0);
+        stamp[g].assign(nblocks, 0);
+        epoch[g] = 1;
+    }
+}
+
+// splitmix64's finalizer, to spread the 32 bit packet hash
+static inline uint64_t mix64(uint64_t z)
+{
+    z += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// the block comes from one mix of the hash, bit positions are 9 bit slices of further mixes.
+// (double hashing a+i*b inside a 512 bit block measured ~15x worse than independent slices.)
+struct duplprobe {
+    uint64_t x;
+    uint32_t block;
+    duplprobe(const uint32_t h, const uint32_t nblocks) : x(mix64(h)) { block = (uint32_t)(((x >> 32) * nblocks) >> 32); }
+    uint32_t next(const uint32_t i) {
+        if (i % 7 == 0) x = mix64(x);
+        return (uint32_t)(x >> (9 * (i % 7))) & (duplfilter::block_bits - 1);
+    }
+};
+
+void duplfilter::mark(const uint m, const uint32_t h)
+{
+    for (uint g : {m & 0x01, ((m + 1) % 60) & 0x01}) {
+        duplprobe pr(h, nblocks);
+        uint64_t* blk = &bits[g][(size_t)pr.block * block_words];
+        if (stamp[g][pr.block] != epoch[g]) {
+            std::fill(blk, blk + block_words, 0);
+            stamp[g][pr.block] = epoch[g];
+        }
+        for (uint32_t i = 0; i < k; i++) {
+            uint32_t bit = pr.next(i);
+            blk[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+    }
+}
+
+bool duplfilter::test(const uint m, const uint32_t h) const
+{
+    uint g = m & 0x01;
+    duplprobe pr(h, nblocks);
+    if (stamp[g][pr.block] != epoch[g]) return false;
+    const uint64_t* blk = &bits[g][(size_t)pr.block * block_words];
+    for (uint32_t i = 0; i < k; i++) {
+        uint32_t bit = pr.next(i);
+        if (!(blk[bit / 64] & ((uint64_t)1 << (bit % 64)))) return false;
+    }
+    return true;
+}
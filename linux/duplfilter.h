@@ -0,0 +1,32 @@
+#ifndef DUPLFILTER_H
+#define DUPLFILTER_H
+
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+// windowed duplicate filter. two generations of blocked bloom filter, one per minute parity:
+// a packet is marked in the current and next minute's generation and tested against the current one.
+// every 512 bit block is stamped with the epoch it was written in, so flushing a generation is an
+// epoch bump and stale blocks read as empty.
+struct duplfilter {
+    static constexpr uint32_t block_words = 8; // 512 bits, one cache line
+    static constexpr uint32_t block_bits = block_words * 64;
+
+    uint32_t nblocks = 0;
+    uint32_t k = 0; // bits set per packet
+    std::vector<uint64_t> bits[2];
+    std::vector<uint32_t> stamp[2]; // per block epoch
+    uint32_t epoch[2] = {1, 1};
+
+    duplfilter() { configure(4096, 1e-4); }
+
+    // size for this many distinct packets per minute at this false positive rate
+    void configure(const uint32_t per_minute, const double fpr);
+
+    void mark(const uint m, const uint32_t h);
+    bool test(const uint m, const uint32_t h) const;
+    void clear(const uint m) { epoch[m & 0x01]++; }
+};
+
+#endif //DUPLFILTER_H
@@ -0,0 +1,74 @@
+#include <cstring>
+#include <algorithm>
+
+#include "fragstore.h"
+
+fragstore::entry* fragstore::find(const apppacket& ap)
+{
+    for (auto& e : entries)
+        if (e.used && e.msgid == ap.frag_msgid() && e.minute == ap.minute() && e.privcode == ap.pakdat[0]) return &e;
+    return nullptr;
+}
+
+bool fragstore::add(const apppacket& ap, const bool keep)
+{
+    if (entries.size() != cap) entries.assign(cap, entry());
+
+    entry* e = find(ap);
+    if (e && keep && !e->kept) e->used = false; // tracked until now, its earlier text is gone: start over
+    if (!e || !e->used) {
+        // a free entry, the oldest only tracked, or the oldest
+        entry* victim = nullptr;
+        for (auto& c : entries) {
+            if (!c.used) { victim = &c; break; }
+            if (!victim || (victim->kept && !c.kept) || (victim->kept == c.kept && c.age < victim->age)) victim = &c;
+        }
+        if (victim->used) evicted++;
+        e = victim;
+        e->used = true;
+        e->kept = keep;
+        e->privcode = ap.pakdat[0];
+        e->minute = ap.minute();
+        e->msgid = ap.frag_msgid();
+        e->count = ap.frag_count();
+        e->have = 0;
+        e->age = clock++;
+    }
+
+    uint8_t seq = ap.frag_seq();
+    if (seq >= e->count) return complete(*e); // inconsistent count, ignore the fragment
+    if (!(e->have & (1u << seq))) {
+        if (e->kept) {
+            char piece[apppacket::text_max + 1];
+            e->len[seq] = (uint8_t)ap.text(piece);
+            memcpy(e->text[seq], piece, e->len[seq]);
+        }
+        e->have |= 1u << seq;
+        if (complete(*e)) completed++;
+    }
+    return complete(*e);
+}
+
+int fragstore::take(const apppacket& ap, char* buf, size_t bufsize)
+{
+    entry* e = find(ap);
+    if (!e || !e->kept || !complete(*e) || bufsize == 0) return -1;
+    size_t n = 0;
+    for (int s = 0; s < e->count; s++) {
+        size_t l = std::min((size_t)e->len[s], bufsize - 1 - n);
+        memcpy(buf + n, e->text[s], l);
+        n += l;
+    }
+    buf[n] = 0;
+    e->used = false;
+    return (int)n;
+}
+
+void fragstore::expire(const uint8_t m)
+{
+    for (auto& e : entries) {
+        if (!e.used || ::valid_minute(e.minute - m)) continue;
+        if (!complete(e)) expired++;
+        e.used = false;
+    }
+}
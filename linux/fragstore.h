@@ -0,0 +1,49 @@
+#ifndef FRAGSTORE_H
+#define FRAGSTORE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "btbcore.h"
+
+// reassembly of fragmented messages. a fixed number of messages can be in progress, each keyed by
+// privcode, minute and msgid. a message lives as long as its minute routing code is valid, so
+// partial messages time out with the packets that carried them; when full, the oldest is evicted.
+// messages this node won't take are only tracked, which fragments have arrived but not their text,
+// so relays can tell which are unfinished. those are evicted before any kept message.
+struct fragstore {
+    struct entry {
+        bool used = false;
+        bool kept = false; // holding the text, not just tracking
+        uint8_t privcode;
+        uint8_t minute;
+        uint16_t msgid;
+        uint8_t count;
+        uint16_t have; // bit per received fragment
+        uint32_t age; // insertion order, for eviction
+        uint8_t len[apppacket::frag_max];
+        char text[apppacket::frag_max][apppacket::text_max];
+    };
+
+    uint32_t cap = 32; // messages in progress
+    std::vector<entry> entries;
+    uint32_t clock = 0;
+    uint32_t completed = 0;
+    uint32_t expired = 0; // timed out incomplete
+    uint32_t evicted = 0; // dropped to make room
+
+    // keep a fragment, or with keep false only note it arrived. returns true once its message has every fragment
+    bool add(const apppacket& ap, const bool keep = true);
+
+    // copy out a complete message and release it. returns its length, or -1 if it isn't complete
+    int take(const apppacket& ap, char* buf, size_t bufsize);
+
+    // drop every message that is no longer valid at minute m
+    void expire(const uint8_t m);
+
+private:
+    entry* find(const apppacket& ap);
+    static bool complete(const entry& e) { return e.have == (uint16_t)((1u << e.count) - 1); }
+};
+
+#endif //FRAGSTORE_H
@@ -0,0 +1,142 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "btbcore.h"
+#include "hcicap.h"
+
+static uint64_t mono_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+//////////////////
+
+int hcicapture::open(const char* path)
+{
+    do {
+        if (!(f = fopen(path, "wb"))) failmessage_break("Can't create capture file")
+        hcicap_header hdr;
+        memcpy(hdr.magic, hcicap_magic, sizeof(hdr.magic));
+        hdr.start_us = (boost::posix_time::microsec_clock::local_time() - epoch).total_microseconds();
+        if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) failmessage_break("Can't write capture header")
+        t_last_us = mono_us();
+        return 0;
+    } while(false);
+    close();
+    return 1;
+}
+
+void hcicapture::write(const uint8_t* buf, int len)
+{
+    if (!f || len <= 0) return;
+    uint64_t t = mono_us();
+    hcicap_rec rec = {(uint32_t)std::min(t - t_last_us, (uint64_t)UINT32_MAX), (uint16_t)len};
+    t_last_us = t;
+    fwrite(&rec, sizeof(rec), 1, f);
+    fwrite(buf, len, 1, f);
+}
+
+void hcicapture::close()
+{
+    if (f) fclose(f);
+    f = nullptr;
+}
+
+//////////////////
+
+int replayradio::open(const char* path, bool fast)
+{
+    do {
+        maxspeed = fast;
+        if ((cap_fd = ::open(path, O_RDONLY)) < 0) failmessage_break("Can't open capture file")
+        struct stat st;
+        if (fstat(cap_fd, &st) < 0 || (size_t)st.st_size < sizeof(hcicap_header)) failmessage_break("Capture file too short")
+        size = st.st_size;
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, cap_fd, 0);
+        if (p == MAP_FAILED) failmessage_break("Can't map capture file")
+        data = (const uint8_t*)p;
+        madvise(p, size, MADV_SEQUENTIAL);
+
+        hcicap_header hdr;
+        memcpy(&hdr, data, sizeof(hdr));
+        if (memcmp(hdr.magic, hcicap_magic, sizeof(hdr.magic))) failmessage_break("Not a capture file")
+        start = epoch + boost::posix_time::microseconds(hdr.start_us);
+        pos = sizeof(hdr);
+
+        if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) failmessage_break("Can't create replay timer")
+        t0_us = mono_us();
+        arm_next();
+        return 0;
+    } while(false);
+    close();
+    return 1;
+}
+
+void replayradio::close()
+{
+    if (data) munmap((void*)data, size);
+    if (cap_fd >= 0) ::close(cap_fd);
+    if (tfd >= 0) ::close(tfd);
+    data = nullptr;
+    cap_fd = tfd = -1;
+}
+
+// at max speed the timer fires once and is never read, so the fd stays readable
+void replayradio::arm_next()
+{
+    itimerspec its = {{0, 0}, {0, 1}};
+    if (!maxspeed && pos + sizeof(hcicap_rec) <= size) {
+        hcicap_rec rec;
+        memcpy(&rec, data + pos, sizeof(rec));
+        uint64_t due = t0_us + t_us + rec.delta_us;
+        if (due > mono_us()) {
+            its.it_value.tv_sec = due / 1000000;
+            its.it_value.tv_nsec = (due % 1000000) * 1000;
+            timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+            return;
+        }
+    }
+    timerfd_settime(tfd, 0, &its, nullptr);
+}
+
+int replayradio::read(uint8_t* buf, size_t bufsize)
+{
+    do {
+        if (pos + sizeof(hcicap_rec) > size) statusmessage_break("Replay finished")
+        hcicap_rec rec;
+        memcpy(&rec, data + pos, sizeof(rec));
+        if (pos + sizeof(rec) + rec.len > size) failmessage_break("Truncated capture record")
+
+        if (!maxspeed) {
+            uint64_t expirations;
+            if (::read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) failmessage_break("Replay timer error")
+            if (t0_us + t_us + rec.delta_us > mono_us()) { arm_next(); return 0; }
+        }
+
+        memset(buf, 0, bufsize);
+        int count = (int)std::min(bufsize, (size_t)rec.len);
+        memcpy(buf, data + pos + sizeof(rec), count);
+        pos += sizeof(rec) + rec.len;
+        t_us += rec.delta_us;
+        events++;
+
+        if (!maxspeed) arm_next();
+        return count;
+    } while(false);
+
+    if (finished) return -1;
+    finished = true;
+    double secs = (mono_us() - t0_us) / 1e6;
+    printf("replayed %lu events in %.3fs, %.0f events/s\n", (unsigned long)events, secs, secs > 0 ? events / secs : 0);
+    return -1;
+}
@@ -0,0 +1,73 @@
+#ifndef HCICAP_H
+#define HCICAP_H
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "radio.h"
+
+// capture file: a header, then one record per hci event, appended as they arrive
+// <magic x8> <start, local time us since epoch x8> { <us since previous record x4> <len x2> <event...> }*
+struct hcicap_header {
+    char magic[8];
+    uint64_t start_us;
+} __attribute__((packed));
+
+struct hcicap_rec {
+    uint32_t delta_us;
+    uint16_t len;
+} __attribute__((packed));
+
+static constexpr char hcicap_magic[8] = {'b','t','b','c','a','p','\0','\1'};
+
+// writes every hci event the app reads to a capture file
+struct hcicapture {
+    FILE* f = nullptr;
+    uint64_t t_last_us = 0;
+
+    ~hcicapture() { close(); }
+
+    int open(const char* path);
+    void write(const uint8_t* buf, int len);
+    void flush() { if (f) fflush(f); } // once per batch, so a crash or kill loses at most the last one
+    void close();
+};
+
+// plays a capture file back through the receive path, at the captured pace or as fast as it can be read.
+// the fd is a timerfd that becomes readable when the next event is due.
+struct replayradio: public radio {
+    int tfd = -1;
+    int cap_fd = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool maxspeed = false;
+    boost::posix_time::ptime start; // capture clock at the first record
+    std::atomic<uint64_t> t_us{0}; // capture clock offset of the last event read, read by other threads in threaded mode
+    uint64_t t0_us = 0; // monotonic clock at replay start
+    uint64_t events = 0;
+    bool finished = false; // reported
+
+    ~replayradio() override { close(); }
+
+    int open(const char* path, bool fast);
+    void close();
+    bool active() const { return data != nullptr; }
+
+    // the capture's clock, so minute stamps and beacon timers line up with the replayed packets
+    boost::posix_time::ptime now() const { return start + boost::posix_time::microseconds((int64_t)t_us.load()); }
+    uint64_t elapsed_ms() const { return t_us / 1000; }
+
+    int fd() const override { return tfd; }
+    int read(uint8_t* buf, size_t bufsize) override;
+    int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) override { return 0; }
+    int stop_beacon(const int slot) override { return 0; }
+
+private:
+    void arm_next();
+};
+
+#endif //HCICAP_H
@@ -0,0 +1,158 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+
+#include "hcifilter.h"
+
+// the event, as read from an hci socket:
+//   legacy report:   <04> <3e> <plen> <02> <nreports> <evt type> <addr type> <addr x6> <data len> <data...> <rssi>
+//   extended report: <04> <3e> <plen> <0d> <nreports> ... <data len> at 28, <data...> at 29
+// bpf's halfword loads are big endian, so the mfgcode is matched byte swapped
+static constexpr uint32_t legacy_data = 14;
+static constexpr uint32_t ext_data = 29;
+static constexpr uint32_t beacon_code = 0xBEAC;
+static constexpr uint32_t snap_all = 0xFFFF;
+
+static int classic_filter(int sock, uint16_t code)
+{
+    uint32_t swapped = (uint32_t)((code & 0xFF) << 8 | code >> 8);
+    sock_filter prog[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),                          //  0 event code
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x3E, 0, 19),               //  1 not le meta: pass
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 4),                          //  2 nreports
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 17),                  //  3 several: pass
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 3),                          //  4 subevent
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0D, 0, 2),                //  5
+        BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, ext_data),                  //  6
+        BPF_STMT(BPF_JMP | BPF_JA, 2),                                  //  7
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x02, 0, 12),               //  8 not a report: pass
+        BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, legacy_data),               //  9
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1),                          // 10 first structure's type
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x01, 0, 4),                // 11 flags?
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),                          // 12 skip them
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),                         // 13
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),                         // 14
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),                                // 15
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),                          // 16 beacon code
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, beacon_code, 0, 2),         // 17
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),                          // 18 mfgcode
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, swapped, 1, 0),             // 19
+        BPF_STMT(BPF_RET | BPF_K, 0),                                   // 20 drop
+        BPF_STMT(BPF_RET | BPF_K, snap_all),                            // 21 pass
+    };
+    sock_fprog fprog = {(unsigned short)(sizeof(prog) / sizeof(prog[0])), prog};
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0 ? 1 : 0;
+}
+
+static bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    bpf_insn i;
+    memset(&i, 0, sizeof(i));
+    i.code = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off = off;
+    i.imm = imm;
+    return i;
+}
+
+static int bpf(int cmd, bpf_attr& attr) { return (int)syscall(SYS_bpf, cmd, &attr, sizeof(attr)); }
+
+// the classic program's test, then a count in map[0] (passed) or map[1] (dropped).
+// r6 is the skb for the packet loads, r7 the data offset, r8 the verdict, r9 the counter
+int hcifilter::load_ebpf(uint16_t code)
+{
+    int32_t swapped = (int32_t)((code & 0xFF) << 8 | code >> 8);
+    bpf_insn prog[] = {
+        insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),                  //  0
+        insn(BPF_LD | BPF_ABS | BPF_B, 0, 0, 0, 1),                     //  1 event code
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 16, 0x3E),                //  2 not le meta: pass
+        insn(BPF_LD | BPF_ABS | BPF_B, 0, 0, 0, 4),                     //  3 nreports
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 14, 1),                   //  4 several: pass
+        insn(BPF_LD | BPF_ABS | BPF_B, 0, 0, 0, 3),                     //  5 subevent
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 7, 0, 0, ext_data),           //  6
+        insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 2, 0x0D),                 //  7
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 7, 0, 0, legacy_data),        //  8
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 9, 0x02),                 //  9 not a report: pass
+        insn(BPF_LD | BPF_IND | BPF_B, 0, 7, 0, 1),                     // 10 first structure's type
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 3, 0x01),                 // 11 flags?
+        insn(BPF_LD | BPF_IND | BPF_B, 0, 7, 0, 0),                     // 12 skip them
+        insn(BPF_ALU64 | BPF_ADD | BPF_X, 7, 0, 0, 0),                  // 13
+        insn(BPF_ALU64 | BPF_ADD | BPF_K, 7, 0, 0, 1),                  // 14
+        insn(BPF_LD | BPF_IND | BPF_H, 0, 7, 0, 4),                     // 15 beacon code
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 5, beacon_code),          // 16
+        insn(BPF_LD | BPF_IND | BPF_H, 0, 7, 0, 2),                     // 17 mfgcode
+        insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 3, swapped),              // 18
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 8, 0, 0, snap_all),           // 19 pass
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 9, 0, 0, 0),                  // 20
+        insn(BPF_JMP | BPF_JA, 0, 0, 2, 0),                             // 21
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 8, 0, 0, 0),                  // 22 drop
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 9, 0, 0, 1),                  // 23
+        insn(BPF_STX | BPF_MEM | BPF_W, 10, 9, -4, 0),                  // 24 key on the stack
+        insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd), // 25 the map, two slots
+        insn(0, 0, 0, 0, 0),                                            // 26
+        insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),                 // 27
+        insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4),                 // 28
+        insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),    // 29
+        insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 2, 0),                    // 30
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 1),                  // 31
+        insn(BPF_STX | BPF_XADD | BPF_DW, 0, 1, 0, 0),                  // 32
+        insn(BPF_ALU64 | BPF_MOV | BPF_X, 0, 8, 0, 0),                  // 33
+        insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),                           // 34
+    };
+
+    bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uint64_t)(uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    return bpf(BPF_PROG_LOAD, attr);
+}
+
+int hcifilter::attach(int sock, uint16_t code)
+{
+    detach(sock);
+    mfgcode = code;
+
+    bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_ARRAY;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint64_t);
+    attr.max_entries = 2;
+    if ((map_fd = bpf(BPF_MAP_CREATE, attr)) >= 0 && (prog_fd = load_ebpf(code)) >= 0
+            && setsockopt(sock, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) == 0) {
+        counting = attached = true;
+        return 0;
+    }
+    detach(sock);
+    attached = classic_filter(sock, code) == 0;
+    return attached ? 0 : 1;
+}
+
+void hcifilter::detach(int sock)
+{
+    int unused = 0; // the option is ignored, but must be an int
+    if (attached) setsockopt(sock, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+    if (prog_fd >= 0) ::close(prog_fd);
+    if (map_fd >= 0) ::close(map_fd);
+    prog_fd = map_fd = -1;
+    attached = counting = false;
+}
+
+uint64_t hcifilter::count(uint32_t key) const
+{
+    if (!counting) return 0;
+    uint64_t value = 0;
+    bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&value;
+    return bpf(BPF_MAP_LOOKUP_ELEM, attr) < 0 ? 0 : value;
+}
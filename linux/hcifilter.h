@@ -0,0 +1,32 @@
+#ifndef HCIFILTER_H
+#define HCIFILTER_H
+
+#include <cstdint>
+
+// a socket filter that drops advertising reports that aren't btbchat beacons for one mfgcode in the
+// kernel, before they wake the app. everything else (command completions, other le meta events,
+// reports carrying several advertisements) is passed. reports are matched as parse_network reads them:
+// the beacon code and mfgcode, after an optional flags structure.
+// an ebpf program counts what it passes and drops. where ebpf can't be loaded (no CAP_BPF, old kernel)
+// a classic bpf program filters the same way, uncounted.
+struct hcifilter {
+    int prog_fd = -1; // ebpf only
+    int map_fd = -1; // passed, dropped
+    bool attached = false;
+    bool counting = false;
+    uint16_t mfgcode = 0;
+
+    // replaces any filter on sock. 0 on success
+    int attach(int sock, uint16_t code);
+    void detach(int sock);
+
+    // since attach. 0 when not counting
+    uint64_t passed() const { return count(0); }
+    uint64_t dropped() const { return count(1); }
+
+private:
+    uint64_t count(uint32_t key) const;
+    int load_ebpf(uint16_t code);
+};
+
+#endif //HCIFILTER_H
@@ -0,0 +1,361 @@
+#include <unistd.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "btbcore.h"
+#include "hciradio.h"
+
+// instead of sudo ... consider `sudo setcap CAP_NET_RAW+ep "$(readlink -f /usr/sbin/app)"`
+// https://security.stackexchange.com/q/128958
+int hci_up(int dev_id)
+{
+    int ctl = socket(AF_BLUETOOTH, SOCK_RAW, BTPROTO_HCI);
+    int fail = (ioctl(ctl, HCIDEVUP, dev_id) < 0) && (errno != EALREADY) ? 1 : 0;
+    ::close(ctl);
+    return fail;
+}
+
+static uint64_t monotonic_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// LE controller commands and events added with extended advertising (core 5.0, vol 4 part E 7.8)
+static constexpr uint16_t ocf_le_read_local_features = 0x0003;
+static constexpr uint16_t ocf_le_set_ext_adv_params = 0x0036;
+static constexpr uint16_t ocf_le_set_ext_adv_data = 0x0037;
+static constexpr uint16_t ocf_le_set_ext_adv_enable = 0x0039;
+static constexpr uint16_t ocf_le_read_num_adv_sets = 0x003B;
+static constexpr uint16_t ocf_le_clear_adv_sets = 0x003D;
+static constexpr uint16_t ocf_le_set_ext_scan_params = 0x0041;
+static constexpr uint16_t ocf_le_set_ext_scan_enable = 0x0042;
+static constexpr uint8_t le_ext_adv_report = 0x0D;
+static constexpr uint8_t le_feature_ext_adv = 12; // bit in the le feature mask
+
+// octet << 3 | bit in the supported commands mask (core 5.0, vol 2 part E 6.27)
+static constexpr int cmd_bits_ext_adv[] = {36 << 3 | 1, 36 << 3 | 2, 36 << 3 | 4, 36 << 3 | 6, 37 << 3 | 0};
+static constexpr int cmd_bits_ext_scan[] = {37 << 3 | 4, 37 << 3 | 5};
+
+// a blocking le command for setup and teardown. 0 when the controller reports success
+static int le_request(int dev_fd, uint16_t ocf, void* cparam, int clen, uint8_t* rparam, int rlen, int timeout)
+{
+    uint8_t status = 0xFF;
+    if (!rparam) { rparam = &status; rlen = 1; }
+    hci_request rq = {OGF_LE_CTL, ocf, 0, cparam, clen, rparam, rlen};
+    return (hci_send_req(dev_fd, &rq, timeout) < 0 || rparam[0]) ? 1 : 0;
+}
+
+//////////////////
+
+int hciradio::open(int id, int sets, int use)
+{
+    do {
+        dev_id = id;
+        role = use;
+        if (hci_up(dev_id)) failmessage_break("Can't bring up hci")
+        if ((dev_fd = hci_open_dev(dev_id)) < 0) failmessage_break("Could not open device")
+        if (fcntl(dev_fd, F_SETFL, fcntl(dev_fd, F_GETFL) | O_NONBLOCK) < 0) failmessage_break("Could not make device non-blocking")
+
+        // configure scan mode. a controller refuses extended commands once legacy ones have been used
+        // (and the other way around) so the choice is made here, before anything is sent
+        extended = false;
+        nsets = (role & role_advertise) ? 1 : 0;
+        if (sets > 1 && nsets && open_extended(sets) == 0) {
+            extended = true;
+        } else if (role & role_scan) {
+            if (hci_le_set_scan_parameters(dev_fd, SCAN_TYPE, htobs(SCAN_INTERVAL), htobs(SCAN_WINDOW), LE_PUBLIC_ADDRESS, SCAN_FILTER_POLICY, TO_10SECS) < 0) failmessage_break("Set scan parameters failed")
+            if (hci_le_set_scan_enable(dev_fd, 0x01, SCAN_FILTER_DUP, TO_10SECS) < 0) failmessage_break("Enable scan failed")
+        }
+
+        // save and set filter. only what read() handles: command completions and le meta events
+        socklen_t olen = sizeof(old_sock_settings);
+        if (getsockopt(dev_fd, SOL_HCI, HCI_FILTER, &old_sock_settings, &olen) < 0) failmessage_break("HCI filter save failed")
+        struct hci_filter flt;
+        hci_filter_clear(&flt);
+        hci_filter_set_ptype(HCI_EVENT_PKT, &flt);
+        hci_filter_set_event(EVT_CMD_COMPLETE, &flt);
+        hci_filter_set_event(EVT_CMD_STATUS, &flt);
+        hci_filter_set_event(EVT_LE_META_EVENT, &flt);
+        if (setsockopt(dev_fd, SOL_HCI, HCI_FILTER, &flt, sizeof(flt)) < 0) failmessage_break("HCI filter set failed")
+
+        if (!extended) hci_le_set_advertise_enable(dev_fd, 0x00, TO_1SEC); // ignore fail
+        forget_state();
+        return 0;
+    } while(false);
+    return 1;
+}
+
+int hciradio::set_filter(uint16_t mfgcode)
+{
+    if (dev_fd < 0 || !(role & role_scan)) return 1;
+    if (filter.attached && filter.mfgcode == mfgcode) return 0;
+    if (filter.attach(dev_fd, mfgcode)) { failmessage("HCI socket filter refused"); return 1; }
+    logmessage(log_status, "HCI socket filter for mfgcode %04X, counting %d", mfgcode, (int)filter.counting);
+    return 0;
+}
+
+static bool has_commands(const uint8_t* mask, const int* bits, const size_t n)
+{
+    for (size_t i = 0; i < n; i++) if (!(mask[bits[i] >> 3] & (1 << (bits[i] & 7)))) return false;
+    return true;
+}
+
+// check for extended advertising, size the sets and, when scanning, start an extended scan. 0 on success, 1 to fall back to legacy.
+// a controller that has seen an extended command refuses legacy ones until reset, so the choice is made from the
+// feature and supported commands masks first. should an extended command still fail, the controller is reset
+int hciradio::open_extended(int sets)
+{
+    do {
+        uint8_t features[9]; // status, 8 byte mask
+        if (le_request(dev_fd, ocf_le_read_local_features, nullptr, 0, features, sizeof(features), TO_1SEC)) statusmessage_break("LE features unavailable, using legacy advertising")
+        if (!(features[1 + le_feature_ext_adv / 8] & (1 << (le_feature_ext_adv % 8)))) statusmessage_break("No extended advertising, using legacy advertising")
+        uint8_t commands[64];
+        if (hci_read_local_commands(dev_fd, commands, TO_1SEC) < 0) statusmessage_break("Supported commands unavailable, using legacy advertising")
+        if (!has_commands(commands, cmd_bits_ext_adv, sizeof(cmd_bits_ext_adv) / sizeof(int))
+                || ((role & role_scan) && !has_commands(commands, cmd_bits_ext_scan, sizeof(cmd_bits_ext_scan) / sizeof(int))))
+            statusmessage_break("Extended commands missing, using legacy advertising")
+        if (open_extended_sets(sets) == 0) return 0;
+        if (ioctl(dev_fd, HCIDEVRESET, dev_id) < 0) failmessage_break("Controller reset failed")
+        statusmessage("Controller reset, using legacy advertising")
+    } while(false);
+    return 1;
+}
+
+// the extended commands proper, once the controller is known to have them. 0 on success
+int hciradio::open_extended_sets(int sets)
+{
+    do {
+        uint8_t numsets[2]; // status, count
+        if (le_request(dev_fd, ocf_le_read_num_adv_sets, nullptr, 0, numsets, sizeof(numsets), TO_1SEC) || numsets[1] < 1) statusmessage_break("No advertising sets")
+        le_request(dev_fd, ocf_le_clear_adv_sets, nullptr, 0, nullptr, 0, TO_1SEC); // ignore fail
+
+        if (role & role_scan) {
+            // own addr type, filter policy, 1M phy only, then scan type, interval, window for it
+            uint8_t scan_params[8] = {LE_PUBLIC_ADDRESS, SCAN_FILTER_POLICY, 0x01, SCAN_TYPE};
+            put_le16(SCAN_INTERVAL, scan_params + 4);
+            put_le16(SCAN_WINDOW, scan_params + 6);
+            if (le_request(dev_fd, ocf_le_set_ext_scan_params, scan_params, sizeof(scan_params), nullptr, 0, TO_10SECS)) statusmessage_break("Extended scan refused")
+
+            // enable, filter dups, no duration, no period
+            uint8_t scan_enable[6] = {0x01, SCAN_FILTER_DUP, 0, 0, 0, 0};
+            if (le_request(dev_fd, ocf_le_set_ext_scan_enable, scan_enable, sizeof(scan_enable), nullptr, 0, TO_10SECS)) statusmessage_break("Extended scan refused")
+        }
+
+        nsets = std::min(std::min(sets, (int)numsets[1]), max_sets);
+        logmessage(log_status, "Extended advertising with %d sets", nsets);
+        return 0;
+    } while(false);
+    return 1;
+}
+
+void hciradio::close()
+{
+    if (dev_fd < 0) return;
+
+    // reset filters, halt scanning and advertising
+    filter.detach(dev_fd);
+    setsockopt(dev_fd, SOL_HCI, HCI_FILTER, &old_sock_settings, sizeof(old_sock_settings));
+    if (extended) {
+        uint8_t scan_disable[6] = {0};
+        uint8_t adv_disable_all[2] = {0x00, 0}; // disable, no sets listed means all of them
+        if (role & role_scan) le_request(dev_fd, ocf_le_set_ext_scan_enable, scan_disable, sizeof(scan_disable), nullptr, 0, TO_1SEC); // ignore fail
+        le_request(dev_fd, ocf_le_set_ext_adv_enable, adv_disable_all, sizeof(adv_disable_all), nullptr, 0, TO_1SEC); // ignore fail
+        le_request(dev_fd, ocf_le_clear_adv_sets, nullptr, 0, nullptr, 0, TO_1SEC); // ignore fail
+    } else {
+        if (role & role_scan) hci_le_set_scan_enable(dev_fd, 0x00, SCAN_FILTER_DUP, TO_1SEC); // ignore fail
+        hci_le_set_advertise_enable(dev_fd, 0x00, TO_1SEC); // ignore fail
+    }
+
+    hci_close_dev(dev_fd);
+    dev_fd = -1;
+    forget_state();
+}
+
+// after an error or a timeout nothing is known about the controller, so the next beacon resends everything.
+// it may still be advertising, so without params_ok a slot's enabled flag means nothing and it is disabled first
+void hciradio::forget_state()
+{
+    cmdq.clear();
+    cmd_sent = false;
+    for (auto& a : adv) a = hciadvstate();
+}
+
+void hciradio::queue_cmd(const uint8_t slot, const uint16_t ocf, const void* param, const uint8_t plen)
+{
+    uint16_t opcode = cmd_opcode_pack(OGF_LE_CTL, ocf);
+
+    // a newer copy of the last command, if it hasn't gone out yet, just replaces it. one further back
+    // stays put, as it may be bracketed by a disable and an enable
+    if (cmdq.size() > (cmd_sent ? 1u : 0u) && cmdq.back().opcode == opcode && cmdq.back().slot == slot) {
+        memcpy(cmdq.back().param, param, plen);
+        cmdq.back().plen = plen;
+        return;
+    }
+    hcicmd cmd = {opcode, slot, plen, {0}, monotonic_ms()};
+    memcpy(cmd.param, param, plen);
+    cmdq.push_back(cmd);
+}
+
+void hciradio::queue_enable(const int slot, const bool on)
+{
+    if (extended) {
+        // enable, one set: handle, no duration, no event limit
+        uint8_t enable[6] = {(uint8_t)on, 1, (uint8_t)slot, 0, 0, 0};
+        queue_cmd(slot, ocf_le_set_ext_adv_enable, enable, sizeof(enable));
+    } else {
+        le_set_advertise_enable_cp enable = {(uint8_t)on};
+        queue_cmd(slot, OCF_LE_SET_ADVERTISE_ENABLE, &enable, sizeof(enable));
+    }
+    adv[slot].enabled = on;
+}
+
+// put the front command on the wire if nothing is in flight. 0 on success
+int hciradio::send_next()
+{
+    if (cmd_sent || cmdq.empty()) return 0;
+    hcicmd& cmd = cmdq.front();
+    if (hci_send_cmd(dev_fd, cmd_opcode_ogf(cmd.opcode), cmd_opcode_ocf(cmd.opcode), cmd.plen, cmd.param) < 0) {
+        forget_state();
+        return 1;
+    }
+    cmd_sent = true;
+    cmd_time = monotonic_ms();
+    return 0;
+}
+
+// a lost completion would hold the queue forever. checked on reads and on beacon changes, as an
+// advertise only adapter, or a quiet channel, may not read again. call under cmd_lock
+void hciradio::check_timeout()
+{
+    if (cmd_sent && monotonic_ms() - cmd_time > TO_1SEC) {
+        statusmessage("HCI command timed out");
+        cmd_timeouts++;
+        forget_state();
+    }
+}
+
+void hciradio::complete(const uint16_t opcode, const uint8_t status)
+{
+    if (!cmd_sent || cmdq.front().opcode != opcode) return; // someone else's
+    cmd_latency.add(monotonic_ms() - cmdq.front().queued);
+    cmdq.pop_front();
+    cmd_sent = false;
+    if (status) {
+        cmd_failed++;
+        logmessage(log_status, "HCI command 0x%04X failed, status 0x%02X", opcode, status);
+        forget_state();
+        return;
+    }
+    send_next();
+}
+
+// rewrite a complete, single, legacy pdu extended advertising report as the legacy report the packet parser expects:
+// <04> <3e> <plen> <0d> <nreports> <evt type x2> <addr type> <addr x6> <phy x2> <sid> <txpower> <rssi> <interval x2> <daddr type> <daddr x6> <data len> <data...>
+// <04> <3e> <plen> <02> <nreports> <evt type> <addr type> <addr x6> <data len> <data...> <rssi>
+static int ext_to_legacy(uint8_t* buf, int count)
+{
+    uint16_t evt_type = get_le16(buf + 5);
+    uint8_t datalen = buf[28];
+    if (count < 29 + datalen || datalen > 31) return count;
+    if (!(evt_type & 0x0010) || (evt_type & 0x0060)) return count; // not legacy, or incomplete
+    int8_t rssi = (int8_t)buf[18];
+    buf[2] = (uint8_t)(12 + datalen);
+    buf[3] = hci_le_adv_report;
+    buf[5] = 0x03; // ADV_NONCONN_IND
+    // addr type and addr move down one byte
+    memmove(buf + 6, buf + 7, 7);
+    buf[13] = datalen;
+    memmove(buf + 14, buf + 29, datalen);
+    buf[14 + datalen] = (uint8_t)rssi;
+    return 15 + datalen;
+}
+
+int hciradio::read(uint8_t* buf, size_t bufsize)
+{
+    do {
+        memset(buf, 0, bufsize);
+        int count = ::read(dev_fd, (void *) buf, bufsize);
+        if (count == 0) failmessage_break("Socket closed")
+        else if ((count < 0) && !(errno == EAGAIN || errno == EINTR)) failmessage_break("Unknown socket error")
+
+        // completions for queued commands. the event is still handed up, the packet parser ignores it
+        if (count >= 7 && buf[0] == HCI_EVENT_PKT) {
+            if (buf[1] == EVT_CMD_COMPLETE) { std::lock_guard<std::mutex> lock(cmd_lock); complete(get_le16(buf + 4), buf[6]); }
+            else if (buf[1] == EVT_CMD_STATUS) { std::lock_guard<std::mutex> lock(cmd_lock); complete(get_le16(buf + 5), buf[3]); }
+            else if (buf[1] == hci_evt_le_meta && buf[3] == le_ext_adv_report && buf[4] == 1 && count >= 29) count = ext_to_legacy(buf, count);
+        }
+        if (cmd_sent) { std::lock_guard<std::mutex> lock(cmd_lock); check_timeout(); }
+        return count < 0 ? 0 : count;
+    } while(false);
+    return -1;
+}
+
+int hciradio::set_beacon(const int slot, const uint8_t* advbuf, uint8_t len)
+{
+    if (slot < 0 || slot >= nsets) return 1;
+    std::lock_guard<std::mutex> lock(cmd_lock);
+    check_timeout();
+    hciadvstate& a = adv[slot];
+
+    // the parameters only need setting once, and only while advertising is off: disable, params, data, enable
+    if (!a.params_ok) {
+        queue_enable(slot, false);
+
+        // the fastest adv type 3 can advertise in 100ms, so min_internal can't be smaller than 0x00A0 as 0x00A0*.625ms=100ms
+        // https://stackoverflow.com/questions/21124993/is-there-a-way-to-increase-ble-advertisement-frequency-in-bluez#21126744
+        if (extended) {
+            // handle, legacy ADV_NONCONN_IND properties, 3 byte intervals, channels, own/peer addr, filter,
+            // tx power (no preference), 1M primary and secondary phys, sid, no scan request notifications
+            uint8_t p[25] = {(uint8_t)slot, 0x10, 0x00, 0xA0, 0x00, 0x00, 0x40, 0x01, 0x00, 7, 0, 0, 0,0,0,0,0,0, 0, 0x7F, 0x01, 0, 0x01, (uint8_t)slot, 0};
+            queue_cmd(slot, ocf_le_set_ext_adv_params, p, sizeof(p));
+        } else {
+            le_set_advertising_parameters_cp adv_params_cp = {
+                htobs(0x00A0), htobs(0x00A0 * 2),3,0,0,
+                {0,0,0,0},7,0
+            };
+            queue_cmd(slot, OCF_LE_SET_ADVERTISING_PARAMETERS, &adv_params_cp, sizeof(adv_params_cp));
+        }
+        a.params_ok = true;
+    }
+
+    if (len > sizeof(a.data)) len = sizeof(a.data);
+    if (len != a.len || memcmp(advbuf, a.data, len)) {
+        if (extended) {
+            // handle, complete data, no fragmenting, then the length and data of the legacy cp
+            uint8_t d[4 + 31] = {(uint8_t)slot, 0x03, 0x01};
+            uint8_t datalen = std::min(advbuf[0], (uint8_t)31);
+            d[3] = datalen;
+            memcpy(d + 4, advbuf + 1, datalen);
+            queue_cmd(slot, ocf_le_set_ext_adv_data, d, (uint8_t)(4 + datalen));
+        } else {
+            queue_cmd(slot, OCF_LE_SET_ADVERTISING_DATA, advbuf, len);
+        }
+        memcpy(a.data, advbuf, len);
+        a.len = len;
+    }
+
+    if (!a.enabled) queue_enable(slot, true);
+
+    do {
+        if (send_next()) failmessage_break("Unable to send advertising command")
+        return 0;
+    } while(false);
+    return 1;
+}
+
+int hciradio::stop_beacon(const int slot)
+{
+    if (slot < 0 || slot >= nsets) return 0;
+    std::lock_guard<std::mutex> lock(cmd_lock);
+    check_timeout();
+    if (adv[slot].params_ok && !adv[slot].enabled) return 0; // else it may still be on
+    queue_enable(slot, false);
+    return send_next();
+}
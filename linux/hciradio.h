@@ -0,0 +1,97 @@
+#ifndef HCIRADIO_H
+#define HCIRADIO_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#include "radio.h"
+#include "metrics.h"
+#include "hcifilter.h"
+
+#define SCAN_FILTER_DUP 0x01
+#define SCAN_TYPE 0x01
+#define SCAN_FILTER_POLICY 0x00
+#define SCAN_INTERVAL 0x0010
+#define SCAN_WINDOW 0x0010
+
+// an hci command waiting for, or waiting on, its Command Complete
+struct hcicmd {
+    uint16_t opcode;
+    uint8_t slot; // advertising set it applies to
+    uint8_t plen;
+    uint8_t param[40];
+    uint64_t queued; // ms, for the latency histogram
+};
+
+// what the controller's advertising state for one set will be once the command queue drains
+struct hciadvstate {
+    bool params_ok = false;
+    bool enabled = false;
+    uint8_t len = 0;
+    uint8_t data[32];
+};
+
+// a bluez hci device, scanning for beacons and advertising them.
+// on controllers with LE extended advertising several advertising sets, one per beacon slot, can
+// be on the air at once; otherwise there is the one legacy advertiser.
+// advertising commands are queued and sent one at a time without waiting; their completions are
+// picked out of the event stream by read(), and a lost one times out after a second. the controller's advertising state is cached so a
+// beacon swap usually costs a single "set advertising data".
+struct hciradio: public radio {
+    static constexpr int max_sets = 8;
+
+    int dev_id = -1;
+    int dev_fd = -1;
+    hci_filter old_sock_settings;
+    bool extended = false; // using the extended advertising and scanning commands
+    int role = role_both;
+    int nsets = 1; // 0 when not advertising
+    hcifilter filter; // drops other apps' advertisements in the kernel
+
+    // command state. in threaded mode completions arrive on the receive thread and beacons on the
+    // command thread, so it is all held under cmd_lock
+    std::mutex cmd_lock;
+    std::deque<hcicmd> cmdq; // front is in flight once sent
+    std::atomic<bool> cmd_sent{false};
+    uint64_t cmd_time = 0; // ms, when the in flight command went out
+    hciadvstate adv[max_sets];
+
+    // stats, written on whichever thread reads or sets beacons
+    histogram cmd_latency; // ms from a beacon change queueing a command to its completion
+    std::atomic<uint64_t> cmd_failed{0};
+    std::atomic<uint64_t> cmd_timeouts{0};
+
+    ~hciradio() override { close(); }
+
+    // sets > 1 asks for that many extended advertising sets, if the controller has them.
+    // role_scan leaves the advertiser alone, role_advertise never starts a scan
+    int open(int id, int sets = 1, int use = role_both);
+    void close();
+    // (re)attach the socket filter for beacons under mfgcode. 0 on success
+    int set_filter(uint16_t mfgcode);
+
+    int fd() const override { return dev_fd; }
+    int read(uint8_t* buf, size_t bufsize) override;
+    int beacon_slots() const override { return nsets; }
+    int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) override;
+    int stop_beacon(const int slot) override;
+
+private:
+    int open_extended(int sets);
+    int open_extended_sets(int sets);
+    void queue_cmd(const uint8_t slot, const uint16_t ocf, const void* param, const uint8_t plen);
+    void queue_enable(const int slot, const bool on);
+    int send_next();
+    void check_timeout();
+    void complete(const uint16_t opcode, const uint8_t status);
+    void forget_state();
+};
+
+int hci_up(int dev_id);
+
+#endif //HCIRADIO_H
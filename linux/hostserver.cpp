@@ -0,0 +1,201 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "hostserver.h"
+
+// fr_message frames held before the batch is sent regardless, well under IOV_MAX
+static constexpr size_t batch_frames_max = 256;
+
+int hostserver::open(const char* sockpath)
+{
+    do {
+        path = sockpath;
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) failmessage_break("Socket path too long")
+        strcpy(addr.sun_path, path);
+
+        if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) failmessage_break("Can't create socket")
+        unlink(path); // a stale socket from a previous run
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) failmessage_break("Can't bind socket")
+        if (listen(listen_fd, 16) < 0) failmessage_break("Can't listen on socket")
+
+        if ((ep_fd = epoll_create1(0)) < 0) failmessage_break("Can't create epoll set")
+        epoll_event ev = {EPOLLIN, {.u32 = (uint32_t)max_clients}};
+        if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) failmessage_break("Can't poll socket")
+        return 0;
+    } while(false);
+    close();
+    return 1;
+}
+
+void hostserver::close()
+{
+    for (int c = 0; c < max_clients; c++) if (clients[c].fd >= 0) drop(c);
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+        unlink(path);
+    }
+    if (ep_fd >= 0) ::close(ep_fd);
+    listen_fd = ep_fd = -1;
+}
+
+void hostserver::poll()
+{
+    epoll_event events[16];
+    int nevt = epoll_wait(ep_fd, events, 16, 0);
+    for (int e = 0; e < nevt; e++) {
+        uint32_t c = events[e].data.u32;
+        if (c == max_clients) { accept_all(); continue; }
+        if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_client(c);
+        if (clients[c].fd >= 0 && (events[e].events & EPOLLOUT)) flush_client(c);
+    }
+}
+
+void hostserver::accept_all()
+{
+    int cfd;
+    while ((cfd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int c = 0;
+        while (c < max_clients && clients[c].fd >= 0) c++;
+        epoll_event ev = {EPOLLIN, {.u32 = (uint32_t)c}};
+        if (c == max_clients || epoll_ctl(ep_fd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            statusmessage("Client refused");
+            ::close(cfd);
+            continue;
+        }
+        clients[c].fd = cfd;
+        nclients++;
+    }
+}
+
+void hostserver::read_client(const int c)
+{
+    client& cl = clients[c];
+    uint8_t buf[4096];
+    int n = ::read(cl.fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) { drop(c); return; }
+    cl.in.insert(cl.in.end(), buf, buf + n);
+
+    // whole frames, the rest waits for more
+    size_t pos = 0;
+    while (cl.in.size() - pos >= 2) {
+        int flen = get_le16(&cl.in[pos]);
+        if (flen < 1 || flen > frame_max - 2) { dropped++; drop(c); return; }
+        if (cl.in.size() - pos < (size_t)(2 + flen)) break;
+        if (parse_frame(c, &cl.in[pos + 2], flen)) { dropped++; drop(c); return; }
+        pos += 2 + flen;
+    }
+    cl.in.erase(cl.in.begin(), cl.in.begin() + pos);
+}
+
+// 0 if the frame was understood
+int hostserver::parse_frame(const int c, const uint8_t* f, const int len)
+{
+    client& cl = clients[c];
+    if (len < 2) return 1; // every client frame has a privcode
+    switch (f[0]) {
+        case fr_send: {
+            sends.emplace_back();
+            hostsend& s = sends.back();
+            s.client = c;
+            s.privcode = f[1];
+            s.len = std::min(len - 2, apppacket::msg_max);
+            memcpy(s.text, f + 2, s.len);
+            s.text[s.len] = 0;
+            return 0;
+        }
+        case fr_subscribe: cl.subs[f[1] / 64] |= (uint64_t)1 << (f[1] % 64); return 0;
+        case fr_unsubscribe: cl.subs[f[1] / 64] &= ~((uint64_t)1 << (f[1] % 64)); return 0;
+        default: return 1;
+    }
+}
+
+void hostserver::sent(const int c, const int chars)
+{
+    client& cl = clients[c];
+    if (cl.fd < 0) return;
+    uint8_t f[5] = {3, 0, fr_sent};
+    put_le16((uint16_t)chars, f + 3);
+    cl.out.insert(cl.out.end(), f, f + sizeof(f));
+}
+
+void hostserver::feed(const uint8_t priv, const int8_t rssi, const char* text, const int len)
+{
+    if (nclients == 0) return;
+    if (frames.size() == batch_frames_max) flush();
+    uint16_t flen = (uint16_t)(1 + 2 + len);
+    frames.push_back({(uint32_t)batch.size(), (uint16_t)(2 + flen), priv});
+    uint8_t hdr[5] = {0, 0, fr_message, priv, (uint8_t)rssi};
+    put_le16(flen, hdr);
+    batch.insert(batch.end(), hdr, hdr + sizeof(hdr));
+    batch.insert(batch.end(), text, text + len);
+}
+
+void hostserver::flush()
+{
+    for (int c = 0; c < max_clients; c++) if (clients[c].fd >= 0) flush_client(c);
+    batch.clear();
+    frames.clear();
+}
+
+// the client's backlog then its batch frames in one sendmsg. whatever didn't go becomes the new backlog
+void hostserver::flush_client(const int c)
+{
+    client& cl = clients[c];
+    iovec iov[1 + batch_frames_max];
+    int niov = 0;
+    uint32_t nframes = 0;
+    if (!cl.out.empty()) iov[niov++] = {cl.out.data(), cl.out.size()};
+    for (auto& f : frames) {
+        if (!cl.subscribed(f.privcode)) continue;
+        iov[niov++] = {batch.data() + f.offset, f.len};
+        nframes++;
+    }
+    if (niov == 0) return;
+
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    ssize_t n = sendmsg(cl.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && errno != EAGAIN && errno != EINTR) { drop(c); return; }
+    delivered += nframes;
+
+    std::vector<uint8_t> rest;
+    size_t skip = n < 0 ? 0 : (size_t)n;
+    for (int i = 0; i < niov; i++) {
+        const uint8_t* p = (const uint8_t*)iov[i].iov_base;
+        size_t l = iov[i].iov_len;
+        if (skip >= l) { skip -= l; continue; }
+        rest.insert(rest.end(), p + skip, p + l);
+        skip = 0;
+    }
+    cl.out.swap(rest);
+    if (cl.out.size() > backlog_max) { statusmessage("Client too slow, dropped"); dropped++; drop(c); return; }
+    want_write(c, !cl.out.empty());
+}
+
+void hostserver::want_write(const int c, const bool on)
+{
+    if (clients[c].writing == on) return;
+    clients[c].writing = on;
+    epoll_event ev = {EPOLLIN | (on ? (uint32_t)EPOLLOUT : 0), {.u32 = (uint32_t)c}};
+    epoll_ctl(ep_fd, EPOLL_CTL_MOD, clients[c].fd, &ev);
+}
+
+void hostserver::drop(const int c)
+{
+    client& cl = clients[c];
+    sends.erase(std::remove_if(sends.begin(), sends.end(), [c](const hostsend& s) { return s.client == c; }), sends.end());
+    epoll_ctl(ep_fd, EPOLL_CTL_DEL, cl.fd, nullptr);
+    ::close(cl.fd);
+    cl = client();
+    nclients--;
+}
@@ -0,0 +1,98 @@
+#ifndef HOSTSERVER_H
+#define HOSTSERVER_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "btbcore.h"
+
+// daemon mode's client api: local apps connect to a unix stream socket instead of sharing stdin.
+// every frame, either way, is
+//   <len lo> <len hi> <type> <payload...>   len counts the type byte and the payload
+// client to daemon:
+//   fr_send <privcode> <text...>     queue a message, answered by fr_sent
+//   fr_subscribe <privcode>          feed received messages with this privcode
+//   fr_unsubscribe <privcode>
+// daemon to client:
+//   fr_sent <chars lo> <chars hi>    how much of the text was queued
+//   fr_message <privcode> <rssi> <text...>   rssi as our adapter heard the message, int8
+// received messages are framed once into a shared batch, then each client gets a single gathering
+// send per batch of the frames it subscribes to. what a slow client can't take is kept for it,
+// up to backlog_max, after which it is dropped.
+struct hostserver {
+    enum { fr_send = 0x01, fr_subscribe = 0x02, fr_unsubscribe = 0x03, fr_sent = 0x81, fr_message = 0x82 };
+
+    static constexpr int max_clients = 64;
+    static constexpr int header_size = 3;
+    static constexpr int frame_max = header_size + 2 + apppacket::msg_max;
+    static constexpr size_t backlog_max = 64 * 1024;
+
+    struct client {
+        int fd = -1;
+        uint64_t subs[4] = {0}; // bit per privcode
+        std::vector<uint8_t> in; // a partial frame
+        std::vector<uint8_t> out; // what the socket couldn't take yet
+        bool writing = false; // polled for EPOLLOUT, while out has something
+        bool subscribed(const uint8_t priv) const { return subs[priv / 64] & ((uint64_t)1 << (priv % 64)); }
+    };
+
+    // a message a client asked to send, for the app to queue
+    struct hostsend {
+        int client;
+        uint8_t privcode;
+        int len;
+        char text[apppacket::msg_max + 1];
+    };
+
+    const char* path = nullptr;
+    int listen_fd = -1;
+    int ep_fd = -1; // readable when the listener or a client needs a look
+    client clients[max_clients];
+    int nclients = 0;
+    std::deque<hostsend> sends;
+
+    // this pass's fr_message frames
+    struct batchframe {
+        uint32_t offset;
+        uint16_t len;
+        uint8_t privcode;
+    };
+    std::vector<uint8_t> batch;
+    std::vector<batchframe> frames;
+
+    // counters
+    uint64_t delivered = 0; // message frames handed to clients
+    uint64_t dropped = 0; // clients dropped for a full backlog or a bad frame
+
+    ~hostserver() { close(); }
+
+    // listen on a unix socket, replacing a stale one. 0 on success
+    int open(const char* sockpath);
+    void close();
+    bool active() const { return listen_fd >= 0; }
+
+    int fd() const { return ep_fd; }
+
+    // accept, read and write whatever is ready. client sends end up in sends
+    void poll();
+
+    // answer a fr_send
+    void sent(const int c, const int chars);
+
+    // a received message, for every client subscribed to its privcode
+    void feed(const uint8_t priv, const int8_t rssi, const char* text, const int len);
+
+    // send the batch and any replies, one gathering send per client
+    void flush();
+
+private:
+    void accept_all();
+    void read_client(const int c);
+    int parse_frame(const int c, const uint8_t* f, const int len);
+    void flush_client(const int c);
+    void drop(const int c);
+    void want_write(const int c, const bool on);
+};
+
+#endif //HOSTSERVER_H
@@ -0,0 +1,151 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "journal.h"
+#include "btbnode.h"
+
+static_assert(sizeof(journal::record) == 36, "journal record layout");
+
+int journal::open(const char* path)
+{
+    close();
+    reset = false;
+    do {
+        maplen = sizeof(header) + (size_t)nrecs * sizeof(record);
+        if ((fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) failmessage_break("Can't open journal")
+        struct stat st;
+        if (fstat(fd, &st) < 0) failmessage_break("Can't stat journal")
+
+        // only a new file, or a journal, is ever written. one of another shape is started over
+        bool fresh = st.st_size == 0;
+        if (!fresh) {
+            header h;
+            if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != magic) failmessage_break("Not a journal")
+            if (h.nrecs != nrecs || h.recsize != sizeof(record) || (size_t)st.st_size != maplen) {
+                statusmessage("Journal is of another size, starting it over")
+                fresh = reset = true;
+            }
+        }
+        if (fresh && ftruncate(fd, (off_t)maplen) < 0) failmessage_break("Can't size journal")
+        void* p = mmap(nullptr, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) failmessage_break("Can't map journal")
+        head = (header*)p;
+        recs = (record*)(head + 1);
+
+        // zeroed records fail their crc
+        if (fresh) {
+            memset(p, 0, maplen);
+            *head = {magic, nrecs, sizeof(record), 0};
+        }
+        return 0;
+    } while(false);
+    close();
+    return 1;
+}
+
+void journal::close()
+{
+    if (head) munmap(head, maplen);
+    if (fd >= 0) ::close(fd);
+    head = nullptr;
+    recs = nullptr;
+    fd = -1;
+}
+
+journal::record* journal::next(const uint8_t type, const uint8_t m, const uint8_t priority)
+{
+    int ring = ring_of(type);
+    record& r = recs[ring_first(ring) + pos[ring]];
+    pos[ring] = (pos[ring] + 1) % ring_size[ring];
+    r.seq = seq++;
+    r.time = (uint32_t)time(nullptr);
+    r.type = type;
+    r.minute = m;
+    r.priority = priority;
+    r.unused = 0;
+    return &r;
+}
+
+void journal::write(const uint8_t type, const uint8_t m, const uint8_t priority, const uint32_t hash)
+{
+    if (!recs) return;
+    record* r = next(type, m, priority);
+    memset(r->pakdat, 0, sizeof(r->pakdat));
+    put_le32(hash, r->pakdat);
+    r->crc = record_crc(*r);
+}
+
+void journal::write(const uint8_t type, const uint8_t m, const uint8_t priority, const uint8_t* pakdat)
+{
+    if (!recs) return;
+    record* r = next(type, m, priority);
+    memcpy(r->pakdat, pakdat, sizeof(r->pakdat));
+    r->crc = record_crc(*r);
+}
+
+void journal::restore(btbnode& node, const uint8_t m)
+{
+    if (!recs) return;
+
+    // what's whole and recent enough, in the order it was written. each ring carries on after its newest record
+    uint32_t now = (uint32_t)time(nullptr);
+    std::vector<const record*> live;
+    for (int ring = 0; ring < nrings; ring++) {
+        uint32_t newest = 0;
+        for (uint32_t i = 0; i < ring_size[ring]; i++) {
+            const record& r = recs[ring_first(ring) + i];
+            if (r.seq == 0 || r.crc != record_crc(r) || ring_of(r.type) != ring) continue;
+            if (r.seq > newest) { newest = r.seq; pos[ring] = (i + 1) % ring_size[ring]; }
+            if (r.seq >= seq) seq = r.seq + 1;
+            if (r.time + window < now || r.time > now + 60) continue;
+            live.push_back(&r);
+        }
+    }
+    std::sort(live.begin(), live.end(), [](const record* a, const record* b) { return a->seq < b->seq; });
+
+    // picks come after the packets they took, so count them first: a picked mesh packet is gone, a
+    // src packet has that many fewer picks left
+    std::unordered_map<uint32_t, int> src_picks, mesh_picks;
+    for (const record* r : live) {
+        if (r->type == rec_src_picked) src_picks[get_le32(r->pakdat)]++;
+        else if (r->type == rec_mesh_picked) mesh_picks[get_le32(r->pakdat)]++;
+    }
+
+    // the node is walked through the minutes as they were, so the duplicate filter's generations line up
+    for (const record* r : live) {
+        apppacket ap;
+        if (r->type == rec_src || r->type == rec_mesh) {
+            memcpy(ap.pakdat, r->pakdat, sizeof(ap.pakdat));
+            ap.pakhash = crc32(ap.pakdat, sizeof(ap.pakdat));
+            ap.rssi = 0;
+            if (!ap.valid_minute(m)) continue;
+        } else if (r->type == rec_heard) {
+            if (!::valid_minute(r->minute - m)) continue;
+        } else {
+            continue;
+        }
+        node.tick(r->minute);
+        if (r->type == rec_heard) {
+            node.dupl_mark(r->minute, get_le32(r->pakdat));
+        } else if (r->type == rec_src) {
+            int left = node.srcpackets.budget - src_picks[ap.pakhash];
+            if (left <= 0) continue;
+            node.srcpackets.push(ap, TO_3SEC);
+            node.srcpackets.q.back().left = (uint8_t)left;
+        } else {
+            int& picks = mesh_picks[ap.pakhash];
+            if (picks > 0) { picks--; continue; }
+            pripacket pp(ap, TO_2SEC);
+            pp.priority = r->priority;
+            node.meshpackets.insert(pp);
+        }
+        restored++;
+    }
+    node.tick(m);
+}
@@ -0,0 +1,81 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "btbcore.h"
+
+struct btbnode;
+
+// a crash-safe record of what a node has heard and queued, for a warm restart. a fixed size file is
+// mapped and records are written into it in place as a ring, so keeping it costs a memcpy per event
+// and no syscalls. the pages are the kernel's, so they outlive the process however it dies.
+// every record carries a sequence number and a crc32: a torn or stale record is skipped on restore.
+// a packet only lives a couple of minutes, so a ring only has to hold that long a history. there's a
+// ring each for the duplicate filter, the mesh queue and our own packets, so a busy mesh can't push
+// our unsent messages out.
+struct journal {
+    static constexpr uint32_t magic = 0x4A425442; // "BTBJ"
+    static constexpr uint32_t window = 180; // s, older records can't hold anything still valid
+
+    enum { rec_heard = 1, rec_src, rec_mesh, rec_src_picked, rec_mesh_picked };
+
+    // records per ring: two minutes of the duplicate filter's sizing, the mesh queue's default cap
+    // and then some for its picks, and plenty of our own
+    enum { ring_heard = 0, ring_mesh, ring_src, nrings };
+    static constexpr uint32_t ring_size[nrings] = {8192, 8192, 1024};
+    static constexpr uint32_t nrecs = ring_size[ring_heard] + ring_size[ring_mesh] + ring_size[ring_src];
+
+    struct record {
+        uint32_t seq;
+        uint32_t time; // wall clock s
+        uint8_t type;
+        uint8_t minute; // the node's, when written
+        uint8_t priority; // mesh packets
+        uint8_t unused;
+        uint8_t pakdat[apppacket::pak_size]; // heard and picked records hold only the hash, le
+        uint32_t crc; // over the rest
+    };
+
+    struct header {
+        uint32_t magic;
+        uint32_t nrecs;
+        uint32_t recsize;
+        uint32_t unused;
+    };
+
+    int fd = -1;
+    header* head = nullptr;
+    record* recs = nullptr;
+    size_t maplen = 0;
+    uint32_t seq = 1; // of the next record
+    uint32_t pos[nrings] = {0}; // next slot in each ring
+    uint32_t restored = 0; // records replayed by restore
+    bool reset = false; // open found a journal of another shape and started it over
+
+    ~journal() { close(); }
+
+    // map the file, creating it when it is new or empty and resetting a journal of another shape.
+    // any other file is left alone and fails. 0 on success
+    int open(const char* path);
+    void close();
+
+    // replay the records still valid at minute m into node, which should be fresh
+    void restore(btbnode& node, const uint8_t m);
+
+    void heard(const uint8_t m, const uint32_t hash) { write(rec_heard, m, 0, hash); }
+    void src(const uint8_t m, const apppacket& ap) { write(rec_src, m, 0, ap.pakdat); }
+    void mesh(const uint8_t m, const pripacket& pp) { write(rec_mesh, m, (uint8_t)pp.priority, pp.pakdat); }
+    void picked(const uint8_t m, const bool own, const uint32_t hash) { write(own ? rec_src_picked : rec_mesh_picked, m, 0, hash); }
+
+private:
+    void write(const uint8_t type, const uint8_t m, const uint8_t priority, const uint32_t hash);
+    void write(const uint8_t type, const uint8_t m, const uint8_t priority, const uint8_t* pakdat);
+    record* next(const uint8_t type, const uint8_t m, const uint8_t priority);
+    static int ring_of(const uint8_t type) { return type == rec_heard ? ring_heard : (type == rec_mesh || type == rec_mesh_picked) ? ring_mesh : ring_src; }
+    static uint32_t ring_first(const int ring) { return ring == ring_heard ? 0 : ring == ring_mesh ? ring_size[ring_heard] : ring_size[ring_heard] + ring_size[ring_mesh]; }
+    static uint32_t record_crc(const record& r) { return crc32((const uint8_t*)&r, offsetof(record, crc)); }
+};
+
+#endif //JOURNAL_H
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "meshqueue.h"
+
+void meshqueue::add(uint32_t slot, int32_t delta)
+{
+    for (uint32_t i = slot + 1; i < tree.size(); i += i & -i) tree[i] += delta;
+}
+
+// double the slot space and rebuild the tree in O(n)
+void meshqueue::grow()
+{
+    uint32_t oldsize = (uint32_t)weight.size();
+    uint32_t newsize = std::max((uint32_t)16, oldsize * 2);
+    slots.resize(newsize);
+    weight.resize(newsize, 0);
+    lnext.resize(newsize, none);
+    lprev.resize(newsize, none);
+    for (uint32_t s = newsize; s > oldsize; s--) freeslots.push_back(s - 1); // lowest slot reused first
+
+    tree.assign(newsize + 1, 0);
+    for (uint32_t i = 1; i <= newsize; i++) {
+        tree[i] += weight[i - 1];
+        uint32_t parent = i + (i & -i);
+        if (parent <= newsize) tree[parent] += tree[i];
+    }
+}
+
+uint32_t meshqueue::insert(const pripacket& pp)
+{
+    if (freeslots.empty()) grow();
+    uint32_t slot = freeslots.back();
+    freeslots.pop_back();
+
+    // zero priority packets keep the smallest weight so they can still drain
+    uint32_t w = std::min(std::max(pp.priority, (uint)1), max_weight);
+    slots[slot] = pp;
+    weight[slot] = w;
+    lprev[slot] = none;
+    lnext[slot] = lhead[w];
+    if (lhead[w] != none) lprev[lhead[w]] = slot;
+    lhead[w] = slot;
+    add(slot, (int32_t)w);
+    total += w;
+    count++;
+    return slot;
+}
+
+void meshqueue::remove(const uint32_t slot)
+{
+    uint32_t w = weight[slot];
+    if (!w) return;
+    add(slot, -(int32_t)w);
+    weight[slot] = 0;
+    if (lprev[slot] != none) lnext[lprev[slot]] = lnext[slot];
+    else lhead[w] = lnext[slot];
+    if (lnext[slot] != none) lprev[lnext[slot]] = lprev[slot];
+    total -= w;
+    count--;
+    freeslots.push_back(slot);
+}
+
+void meshqueue::clear()
+{
+    std::fill(weight.begin(), weight.end(), 0);
+    std::fill(tree.begin(), tree.end(), 0);
+    std::fill(lhead, lhead + max_weight + 1, none);
+    freeslots.clear();
+    for (uint32_t s = (uint32_t)weight.size(); s > 0; s--) freeslots.push_back(s - 1);
+    total = count = 0;
+}
+
+uint32_t meshqueue::draw(uint32_t r) const
+{
+    // descend the implicit tree, skipping whole subtrees whose weight is <= r
+    uint32_t n = (uint32_t)tree.size() - 1;
+    uint32_t pos = 0;
+    uint32_t step = 1;
+    while (step * 2 <= n) step *= 2;
+    for (; step; step >>= 1) {
+        if (pos + step <= n && tree[pos + step] <= r) {
+            pos += step;
+            r -= tree[pos];
+        }
+    }
+    return pos; // 1-based index pos+1 is slot pos
+}
+
+uint32_t meshqueue::lowest() const
+{
+    if (!count) return none;
+    for (uint32_t w = 1; w <= max_weight; w++) if (lhead[w] != none) return lhead[w];
+    return none;
+}
@@ -0,0 +1,49 @@
+#ifndef MESHQUEUE_H
+#define MESHQUEUE_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "btbcore.h"
+
+// forwardable packets, drawn at random in proportion to their priority.
+// packets live in reusable slots and a fenwick tree over the slot weights gives
+// O(log n) insert, weighted draw and removal. slots are also threaded onto a list per
+// weight so the lowest priority packet can be found for eviction.
+struct meshqueue {
+    static constexpr uint32_t none = UINT32_MAX;
+    static constexpr uint32_t max_weight = 0xFF;
+
+    std::vector<pripacket> slots;
+    std::vector<uint32_t> weight; // per slot, 0 when the slot is free
+    std::vector<uint32_t> tree; // fenwick tree over weight, 1-based
+    std::vector<uint32_t> freeslots;
+    std::vector<uint32_t> lnext, lprev; // per weight lists
+    uint32_t lhead[max_weight + 1];
+    uint32_t total = 0;
+    uint32_t count = 0;
+
+    meshqueue() { std::fill(lhead, lhead + max_weight + 1, none); }
+
+    bool empty() const { return count == 0; }
+    uint32_t size() const { return count; }
+    pripacket& operator[](const uint32_t slot) { return slots[slot]; }
+    const pripacket& operator[](const uint32_t slot) const { return slots[slot]; }
+
+    uint32_t insert(const pripacket& pp);
+    void remove(const uint32_t slot);
+    void clear();
+
+    // the slot whose share of the cumulative weight covers r, for 0 <= r < total
+    uint32_t draw(uint32_t r) const;
+
+    // a slot holding a lowest weight packet, or none
+    uint32_t lowest() const;
+
+private:
+    void add(uint32_t slot, int32_t delta);
+    void grow();
+};
+
+#endif //MESHQUEUE_H
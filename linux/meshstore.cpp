@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstring>
+
+#include "meshstore.h"
+
+meshqueue* meshstore::bucket(const uint8_t m)
+{
+    if (wheel[m]) return wheel[m];
+    meshqueue* q;
+    if (!spare.empty()) {
+        q = spare.back();
+        spare.pop_back();
+        q->clear();
+    } else {
+        pool.emplace_back();
+        q = &pool.back();
+    }
+    live.push_back(m);
+    return wheel[m] = q;
+}
+
+// the whole bucket goes back to the spare list, its slots are reset when it's reused
+void meshstore::drop(const uint8_t m)
+{
+    meshqueue* q = wheel[m];
+    if (!q) return;
+    count -= q->count;
+    total -= q->total;
+    expired += q->count;
+    spare.push_back(q);
+    wheel[m] = nullptr;
+    live.erase(std::find(live.begin(), live.end(), m));
+}
+
+void meshstore::expire(const uint8_t m)
+{
+    minute = m;
+    for (size_t i = live.size(); i > 0; i--) {
+        uint8_t bm = live[i - 1];
+        if (!::valid_minute(bm - m)) drop(bm);
+    }
+}
+
+int meshstore::insert(const pripacket& pp)
+{
+    uint8_t m = pp.minute() % 60;
+
+    if (count >= cap) {
+        if (policy == evict_none) { evicted++; return 1; }
+
+        // victim: the lowest priority packet, or the lowest in the oldest minute. ties go to the older minute
+        meshqueue* vq = nullptr;
+        uint32_t vslot = meshqueue::none;
+        int vage = -1;
+        for (auto bm : live) {
+            meshqueue* q = wheel[bm];
+            uint32_t slot = q->lowest();
+            if (slot == meshqueue::none) continue;
+            bool better = !vq;
+            if (!better && policy == evict_lowest) better = q->weight[slot] < vq->weight[vslot] || (q->weight[slot] == vq->weight[vslot] && age(bm) > vage);
+            if (!better && policy == evict_oldest) better = age(bm) > vage;
+            if (better) { vq = q; vslot = slot; vage = age(bm); }
+        }
+        if (!vq) { evicted++; return 1; }
+
+        // don't let a weaker packet push out a stronger one
+        if (policy == evict_lowest && std::max(pp.priority, (uint)1) <= vq->weight[vslot]) { evicted++; return 1; }
+
+        count--;
+        total -= vq->weight[vslot];
+        vq->remove(vslot);
+        evicted++;
+    }
+
+    meshqueue* q = bucket(m);
+    uint32_t before = q->total;
+    q->insert(pp);
+    total += q->total - before;
+    count++;
+    return 0;
+}
+
+bool meshstore::pick(txablepacket& packet, const uint8_t m)
+{
+    while (count) {
+        uint32_t r = rnd() % total;
+        for (auto bm : live) {
+            meshqueue* q = wheel[bm];
+            if (r >= q->total) { r -= q->total; continue; }
+            uint32_t slot = q->draw(r);
+            bool valid = (*q)[slot].valid_minute(m);
+            if (valid) packet = (*q)[slot];
+            count--;
+            total -= q->weight[slot];
+            q->remove(slot);
+            if (!valid) statusmessage_break("Skipping expired packet")
+            return true;
+        }
+    }
+    return false;
+}
+
+void meshstore::clear()
+{
+    while (!live.empty()) drop(live.back());
+    expired = evicted = 0;
+}
+
+int meshstore::policy_of(const char* s)
+{
+    if (!strcmp(s, "lowest")) return evict_lowest;
+    if (!strcmp(s, "oldest")) return evict_oldest;
+    if (!strcmp(s, "none")) return evict_none;
+    return -1;
+}
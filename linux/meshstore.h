@@ -0,0 +1,52 @@
+#ifndef MESHSTORE_H
+#define MESHSTORE_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "meshqueue.h"
+
+// the mesh queue, capped and split into a wheel of per-minute meshqueues keyed by the routing byte.
+// packets are only ever accepted for the current or previous minute so at most a couple of buckets
+// are live; on minute rollover a stale bucket is dropped whole and its storage recycled.
+struct meshstore {
+    enum { evict_lowest = 0, evict_oldest, evict_none };
+
+    uint32_t cap = 4096; // packets
+    int policy = evict_lowest;
+
+    meshqueue* wheel[60] = {nullptr};
+    std::vector<uint8_t> live; // minutes with a bucket
+    std::deque<meshqueue> pool; // every bucket ever made, live or spare. a deque so pointers stay put
+    std::vector<meshqueue*> spare;
+    uint8_t minute = 0xFF;
+    uint32_t count = 0;
+    uint32_t total = 0;
+    uint32_t expired = 0; // dropped by rollover
+    uint32_t evicted = 0; // dropped to stay under cap, incoming or queued
+
+    bool empty() const { return count == 0; }
+    uint32_t size() const { return count; }
+
+    // 0 if queued, 1 if dropped because of the cap
+    int insert(const pripacket& pp);
+
+    // weighted draw across buckets. the packet is removed from the store
+    bool pick(txablepacket& packet, const uint8_t m);
+
+    // drop every bucket that is no longer valid at minute m
+    void expire(const uint8_t m);
+
+    void clear();
+
+    // "lowest", "oldest" or "none" to the policy enum, -1 if unknown
+    static int policy_of(const char* s);
+
+private:
+    meshqueue* bucket(const uint8_t m);
+    void drop(const uint8_t m);
+    int age(const uint8_t m) const { return minute == 0xFF ? 0 : ((int)minute - m + 60) % 60; }
+};
+
+#endif //MESHSTORE_H
@@ -0,0 +1,32 @@
+#include "metrics.h"
+
+static void prom_header(FILE* f, const char* name, const char* help, const char* type)
+{
+    if (help) fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void prom_counter(FILE* f, const char* name, const char* help, const char* labels, const uint64_t v)
+{
+    prom_header(f, name, help, "counter");
+    fprintf(f, *labels ? "%s{%s} %lu\n" : "%s%s %lu\n", name, labels, (unsigned long)v);
+}
+
+void prom_gauge(FILE* f, const char* name, const char* help, const char* labels, const double v)
+{
+    prom_header(f, name, help, "gauge");
+    fprintf(f, *labels ? "%s{%s} %g\n" : "%s%s %g\n", name, labels, v);
+}
+
+void prom_histogram(FILE* f, const char* name, const char* help, const char* labels, const histogram& h)
+{
+    prom_header(f, name, help, "histogram");
+    const char* sep = *labels ? "," : "";
+    uint64_t cumulative = 0;
+    for (int b = 0; b < histogram::nbuckets; b++) {
+        cumulative += h.bucket[b].load(std::memory_order_relaxed);
+        if (b < histogram::nbuckets - 1) fprintf(f, "%s_bucket{%s%sle=\"%lu\"} %lu\n", name, labels, sep, (unsigned long)histogram::bound(b), (unsigned long)cumulative);
+        else fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, (unsigned long)cumulative);
+    }
+    fprintf(f, *labels ? "%s_sum{%s} %lu\n" : "%s_sum%s %lu\n", name, labels, (unsigned long)h.sum.load(std::memory_order_relaxed));
+    fprintf(f, *labels ? "%s_count{%s} %lu\n" : "%s_count%s %lu\n", name, labels, (unsigned long)h.count.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,34 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+
+// an always-on histogram with power of two buckets: <= 1, 2, 4 .. 1024, then everything above.
+// relaxed atomics so it can be fed from a radio thread while the protocol thread exports it.
+struct histogram {
+    static constexpr int nbuckets = 12;
+
+    std::atomic<uint64_t> bucket[nbuckets] = {};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+
+    static uint64_t bound(const int b) { return (uint64_t)1 << b; }
+
+    void add(const uint64_t v) {
+        int b = v <= 1 ? 0 : 64 - __builtin_clzll(v - 1);
+        if (b >= nbuckets) b = nbuckets - 1;
+        bucket[b].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// prometheus text exposition. labels is "" or like "adapter=\"hci0\"". the help/type header is
+// written when help is given, so a metric with several label sets passes it only the first time
+void prom_counter(FILE* f, const char* name, const char* help, const char* labels, const uint64_t v);
+void prom_gauge(FILE* f, const char* name, const char* help, const char* labels, const double v);
+void prom_histogram(FILE* f, const char* name, const char* help, const char* labels, const histogram& h);
+
+#endif //METRICS_H
@@ -0,0 +1,95 @@
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <sys/epoll.h>
+
+#include "multiradio.h"
+
+int multiradio::add(radio* dev, const int role)
+{
+    if (nmembers == max_radios || !dev || !(role & role_both)) return 1;
+    member& m = members[nmembers++];
+    m.dev = dev;
+    m.role = role;
+    m.slot0 = nslots;
+    m.nslots = (role & role_advertise) ? std::min(dev->beacon_slots(), max_slots - nslots) : 0;
+    m.frames = 0;
+    nslots += m.nslots;
+    return 0;
+}
+
+int multiradio::open()
+{
+    // every member is polled, not just the scanners: an advertiser's command completions come in as events too
+    for (int i = 0; i < nmembers; i++) {
+        int mfd = members[i].dev->fd();
+        if (mfd < 0) continue;
+        if (ep_fd < 0 && (ep_fd = epoll_create1(0)) < 0) return 1;
+        epoll_event ev = {EPOLLIN, {.u32 = (uint32_t)i}};
+        if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, mfd, &ev) < 0) { close(); return 1; }
+    }
+    return 0;
+}
+
+void multiradio::close()
+{
+    if (ep_fd >= 0) ::close(ep_fd);
+    ep_fd = -1;
+}
+
+bool multiradio::has(const int role) const
+{
+    for (int i = 0; i < nmembers; i++) {
+        if ((role & role_scan) && (members[i].role & role_scan)) return true;
+        if ((role & role_advertise) && members[i].nslots) return true;
+    }
+    return false;
+}
+
+int multiradio::member_of(const int slot, int& local) const
+{
+    for (int i = 0; i < nmembers; i++) {
+        const member& m = members[i];
+        if (slot < m.slot0 || slot >= m.slot0 + m.nslots) continue;
+        local = slot - m.slot0;
+        return i;
+    }
+    return -1;
+}
+
+// one event from the next member that has one, so a busy scanner can't starve the others
+int multiradio::read(uint8_t* buf, size_t bufsize)
+{
+    for (int i = 0; i < nmembers; i++) {
+        int n = (next + i) % nmembers;
+        int count = members[n].dev->read(buf, bufsize);
+        if (count < 0) return -1;
+        if (count == 0) continue;
+        members[n].frames++;
+        next = (n + 1) % nmembers;
+        return count;
+    }
+    return 0;
+}
+
+int multiradio::set_beacon(const int slot, const uint8_t* advbuf, uint8_t len)
+{
+    int local;
+    int n = member_of(slot, local);
+    return n < 0 ? 1 : members[n].dev->set_beacon(local, advbuf, len);
+}
+
+int multiradio::stop_beacon(const int slot)
+{
+    int local;
+    int n = member_of(slot, local);
+    return n < 0 ? 0 : members[n].dev->stop_beacon(local);
+}
+
+int multiradio::role_of(const char* s)
+{
+    if (!strcmp(s, "s")) return role_scan;
+    if (!strcmp(s, "a")) return role_advertise;
+    if (!strcmp(s, "b")) return role_both;
+    return -1;
+}
@@ -0,0 +1,53 @@
+#ifndef MULTIRADIO_H
+#define MULTIRADIO_H
+
+#include <cstdint>
+
+#include "radio.h"
+
+// several radios, each scanning, advertising or both, driven as one. reports from every scanner
+// are read round robin into the one protocol state, and the advertisers' beacon slots are laid end
+// to end so the app's per-slot rotation spreads outgoing packets across all of them.
+struct multiradio: public radio {
+    static constexpr int max_radios = 8;
+    static constexpr int max_slots = 32;
+
+    struct member {
+        radio* dev;
+        int role;
+        int slot0; // first of this radio's slots in the combined numbering
+        int nslots;
+        uint64_t frames; // events read
+    };
+
+    member members[max_radios];
+    int nmembers = 0;
+    int nslots = 0;
+    int ep_fd = -1; // readable when any member is, -1 when every member is driven directly
+    int next = 0; // member read first, round robin
+
+    ~multiradio() override { close(); }
+
+    // add an opened radio in a role. 0 on success
+    int add(radio* dev, const int role);
+    // after the adds, build the poll set. 0 on success
+    int open();
+    void close();
+
+    // some member scans (role_scan) or has a beacon slot (role_advertise)
+    bool has(const int role) const;
+
+    // the member behind a combined slot, and its own slot number there. -1 if none
+    int member_of(const int slot, int& local) const;
+
+    int fd() const override { return ep_fd; }
+    int read(uint8_t* buf, size_t bufsize) override;
+    int beacon_slots() const override { return nslots; }
+    int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) override;
+    int stop_beacon(const int slot) override;
+
+    // "s", "a" or "b" (scan, advertise, both) to a role, -1 if unknown
+    static int role_of(const char* s);
+};
+
+#endif //MULTIRADIO_H
@@ -0,0 +1,71 @@
+#ifndef RADIO_H
+#define RADIO_H
+
+#include <cstdint>
+#include <cstddef>
+
+// a preallocated ring of hci event frames, filled by a radio and drained by the app
+struct hciring {
+    static constexpr uint32_t frame_size = 260; // HCI_MAX_EVENT_SIZE
+    static constexpr uint32_t frames = 64;
+
+    struct frame {
+        uint16_t len;
+        uint8_t data[frame_size];
+    };
+
+    frame slots[frames];
+    uint32_t head = 0; // next to read
+    uint32_t tail = 0; // next to write
+
+    bool empty() const { return head == tail; }
+    bool full() const { return tail - head == frames; }
+    uint32_t size() const { return tail - head; }
+    frame& front() { return slots[head % frames]; }
+    frame& back() { return slots[tail % frames]; } // the free slot a radio writes into
+    void pop() { head++; }
+    void push() { tail++; }
+};
+
+// what a radio is used for. a controller doing both splits its time between scanning and advertising
+enum { role_scan = 0x01, role_advertise = 0x02, role_both = role_scan | role_advertise };
+
+// what the app needs from a controller: a stream of hci events in, one or more beacons out.
+// implemented by hciradio (bluez) and simradio (in-process, for the simulator).
+struct radio {
+    virtual ~radio() = default;
+
+    // pollable fd that signals pending events, or -1 when the radio is driven directly
+    virtual int fd() const = 0;
+
+    // read one hci event into buf. returns its length, 0 when nothing is pending, -1 on device error
+    virtual int read(uint8_t* buf, size_t bufsize) = 0;
+
+    // number of beacons that can be on the air at once, each in its own slot
+    virtual int beacon_slots() const { return 1; }
+
+    // put adv_size bytes of advertising data on the air in a slot, replacing its current beacon. 0 on success
+    virtual int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) = 0;
+
+    // take a slot's beacon off the air. 0 on success
+    virtual int stop_beacon(const int slot) = 0;
+
+    // read pending events into a ring of hciring::frames (an hciring or an spscring) until none are left,
+    // the ring is full or limit are read. returns the number read, or -1 if the device failed before any were
+    template<class Ring>
+    int read_batch(Ring& ring, uint32_t limit) {
+        uint32_t n = 0;
+        while (n < limit && !ring.full()) {
+            hciring::frame& f = ring.back();
+            int count = read(f.data, sizeof(f.data));
+            if (count < 0) return n ? (int)n : -1;
+            if (count == 0) break;
+            f.len = (uint16_t)count;
+            ring.push();
+            n++;
+        }
+        return (int)n;
+    }
+};
+
+#endif //RADIO_H
@@ -0,0 +1,448 @@
+// btbsim: a discrete-event mesh simulator.
+// runs N btbnodes, each on its own simradios, over a log-distance rssi model with shadowing, fading and
+// random loss. messages are injected at random nodes and tracked to report delivery ratio, latency, hops
+// and airtime per message. with a chat corpus, messages are its lines, fragmented as needed, and the report
+// adds how many chars each packet and each ms of airtime carried.
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <getopt.h>
+
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+
+#include "btbnode.h"
+#include "simradio.h"
+#include "multiradio.h"
+
+// legacy ADV_NONCONN_IND with 31 bytes of data: (1 preamble + 4 aa + 2 hdr + 6 addr + 31 data + 3 crc) * 8us,
+// sent on each of the 3 primary channels
+static constexpr double airtime_per_adv_ms = (1 + 4 + 2 + 6 + 31 + 3) * 8 * 3 / 1000.0;
+
+// the fastest adv type 3 interval range that set_beacon asks for: 0x00A0..0x0140 * .625ms
+static constexpr int adv_interval_min_ms = 100;
+static constexpr int adv_interval_max_ms = 200;
+static constexpr int adv_delay_max_ms = 10;
+
+struct simconfig {
+    int nodes = 200;
+    double area = 200; // side of the square nodes are scattered over, metres
+    double seconds = 300; // period messages are injected over
+    double msgrate = 30; // messages per minute, network wide
+    double txpower = -59; // rssi at 1m
+    double pathloss = 2.0; // log-distance exponent
+    double shadowing = 4; // per-link static sigma, dB
+    double fading = 2; // per-reception sigma, dB
+    double sensitivity = -90;
+    double loss = 0.1; // random loss after the rssi test
+    uint32_t meshcap = 4096;
+    int meshpolicy = meshstore::evict_lowest;
+    uint32_t duplpackets = 4096;
+    double duplfpr = 1e-4;
+    int advsets = 1; // beacon slots per advertising radio, >1 models extended advertising
+    const char* roles = "b"; // a node's radios, one s (scan), a (advertise) or b (both) each
+    double busy = 0; // chance a radio that both scans and advertises misses a beacon because it is advertising
+    bool adaptive = false; // adaptive airtime, see airtime.h
+    int srcbudget = 3; // picks per source packet, see srcqueue.h
+    double srcshare = 0.5; // of the picks when a node has both source and mesh packets
+    const char* corpus = nullptr; // chat lines to send, instead of "hello"
+    unsigned seed = 1;
+};
+
+struct simnode {
+    btbnode node;
+    simradio radios[multiradio::max_radios];
+    multiradio radio; // the radios as the node sees them
+    double x, y;
+    bool adv_pending[multiradio::max_slots] = {false};
+    int msgid[multiradio::max_slots]; // per beacon slot, message currently on air, -1 if none or unknown
+    std::vector<std::pair<int, float>> neighbours; // node index, mean rssi
+    double copies_sum = 0; // adaptive airtime's density estimate, sampled at every beacon timer
+    uint32_t copies_n = 0;
+};
+
+struct simmsg {
+    int origin;
+    int64_t t0;
+    uint32_t advs = 0;
+    uint32_t rxcount = 0;
+    int chars = 0; // of corpus text
+    int packets = 0;
+    std::vector<int64_t> t_rx; // per node, -1 until received
+    std::vector<uint8_t> hops;
+};
+
+enum { ev_timer = 0, ev_adv, ev_send };
+
+struct simevent {
+    int64_t t;
+    int type;
+    int node;
+    int slot = 0;
+    bool operator>(const simevent& e) const { return t > e.t; }
+};
+
+static simconfig cfg;
+static std::vector<simnode> nodes;
+static std::vector<simmsg> msgs;
+static std::priority_queue<simevent, std::vector<simevent>, std::greater<simevent>> events;
+static std::mt19937 simrnd;
+
+static uint64_t total_advs = 0;
+
+static std::vector<std::string> corpus;
+static size_t corpus_next = 0;
+
+//////////////////
+
+static inline uint8_t sim_minute(const int64_t t) { return (uint8_t)((t / 60000) % 60); }
+
+// sim messages are found by the hash of any of their packets
+static std::unordered_map<uint32_t, int> pakmsg;
+
+static int packet_msgid(const apppacket& ap)
+{
+    auto it = pakmsg.find(ap.pakhash);
+    return it == pakmsg.end() ? -1 : it->second;
+}
+
+static void place_nodes()
+{
+    std::uniform_real_distribution<double> pos(0, cfg.area);
+    std::normal_distribution<double> shadow(0, cfg.shadowing);
+
+    nodes.resize(cfg.nodes);
+    for (int i = 0; i < cfg.nodes; i++) {
+        simnode& sn = nodes[i];
+        sn.x = pos(simrnd);
+        sn.y = pos(simrnd);
+        sn.node.meshmode = 1;
+        sn.node.meshpackets.cap = cfg.meshcap;
+        sn.node.meshpackets.policy = cfg.meshpolicy;
+        sn.node.dupl_table.configure(cfg.duplpackets, cfg.duplfpr);
+        sn.node.air.adaptive = cfg.adaptive;
+        sn.node.srcpackets.budget = (uint8_t)cfg.srcbudget;
+        sn.node.src_share = cfg.srcshare;
+        for (int r = 0; r < multiradio::max_radios && cfg.roles[r]; r++) {
+            const char role[2] = {cfg.roles[r], 0};
+            for (int b = 0; b < 4; b++) sn.radios[r].bdaddr[b] = (uint8_t)(i >> (b * 8));
+            sn.radios[r].bdaddr[4] = (uint8_t)r;
+            sn.radios[r].nsets = cfg.advsets;
+            sn.radio.add(&sn.radios[r], multiradio::role_of(role));
+        }
+        for (int& id : sn.msgid) id = -1;
+    }
+
+    // links are symmetric and kept only if a lucky fade could reach the receiver
+    for (int i = 0; i < cfg.nodes; i++) {
+        for (int j = i + 1; j < cfg.nodes; j++) {
+            double d = std::max(1.0, std::hypot(nodes[i].x - nodes[j].x, nodes[i].y - nodes[j].y));
+            double rssi = cfg.txpower - 10 * cfg.pathloss * log10(d) + shadow(simrnd);
+            if (rssi + 3 * cfg.fading < cfg.sensitivity) continue;
+            nodes[i].neighbours.emplace_back(j, (float)rssi);
+            nodes[j].neighbours.emplace_back(i, (float)rssi);
+        }
+    }
+}
+
+//////////////////
+
+static void on_timer(const int64_t t, const int n, const int slot)
+{
+    simnode& sn = nodes[n];
+    sn.node.tick(sim_minute(t));
+    if (cfg.adaptive) { sn.copies_sum += sn.node.air.copies; sn.copies_n++; }
+    txablepacket txpak;
+    if (sn.node.pick_packet(txpak, sn.node.minute, slot)) {
+        uint8_t advbuf[apppacket::adv_size];
+        txpak.build_beacon(advbuf, sn.node.mfgcode);
+        sn.radio.set_beacon(slot, advbuf, apppacket::adv_size);
+        sn.msgid[slot] = packet_msgid(txpak);
+        if (!sn.adv_pending[slot]) {
+            sn.adv_pending[slot] = true;
+            events.push({t + (int64_t)(simrnd() % adv_delay_max_ms), ev_adv, n, slot});
+        }
+        events.push({t + txpak.xtime + (int64_t)(rnd() % sn.node.air.jitter()), ev_timer, n, slot});
+    } else {
+        sn.radio.stop_beacon(slot);
+        sn.msgid[slot] = -1;
+        events.push({t + TO_1SEC + (int64_t)(rnd() % sn.node.air.jitter()), ev_timer, n, slot});
+    }
+}
+
+static void on_receive(const int64_t t, const int n, const uint8_t hops)
+{
+    simnode& sn = nodes[n];
+    uint8_t hcibuf[256];
+    apppacket packet;
+    int count;
+    while ((count = sn.radio.read(hcibuf, sizeof(hcibuf))) > 0) {
+        if (packet.parse_network(hcibuf, sn.node.mfgcode)) continue;
+        int rx = sn.node.receive(packet);
+        if (rx != rx_ok && rx != rx_squelched) continue;
+        char text[apppacket::msg_max + 1];
+        sn.node.take_text(packet, text, sizeof(text)); // releases a reassembled message
+        int id = packet_msgid(packet);
+        if (id < 0 || msgs[id].origin == n || msgs[id].t_rx[n] >= 0) continue;
+        msgs[id].t_rx[n] = t - msgs[id].t0;
+        msgs[id].hops[n] = hops;
+        msgs[id].rxcount++;
+    }
+}
+
+static bool advertising(const simradio& r)
+{
+    for (int s = 0; s < r.nsets; s++) if (r.sets[s].advertising) return true;
+    return false;
+}
+
+static void on_adv(const int64_t t, const int n, const int slot)
+{
+    std::normal_distribution<double> fade(0, cfg.fading);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    simnode& sn = nodes[n];
+    int local = 0;
+    const simradio& txradio = sn.radios[sn.radio.member_of(slot, local)];
+    const simradio::advset& set = txradio.sets[local];
+    if (!set.advertising) { sn.adv_pending[slot] = false; return; }
+
+    total_advs++;
+    uint8_t hops = 0;
+    if (sn.msgid[slot] >= 0) {
+        simmsg& m = msgs[sn.msgid[slot]];
+        m.advs++;
+        hops = m.origin == n ? 1 : m.hops[n] + 1;
+    }
+
+    // every scanning radio of a neighbour gets its own fade and loss
+    for (auto& nb : sn.neighbours) {
+        multiradio& rx = nodes[nb.first].radio;
+        for (int r = 0; r < rx.nmembers; r++) {
+            if (!(rx.members[r].role & role_scan)) continue;
+            if ((rx.members[r].role & role_advertise) && cfg.busy > 0 && unit(simrnd) < cfg.busy && advertising(nodes[nb.first].radios[r])) continue;
+            double rssi = nb.second + fade(simrnd);
+            if (rssi < cfg.sensitivity) continue;
+            if (unit(simrnd) < cfg.loss) continue;
+            nodes[nb.first].radios[r].hear(set.beacon, txradio.bdaddr, (int8_t)std::max(-127.0, rssi));
+        }
+        on_receive(t, nb.first, hops);
+    }
+
+    int interval = adv_interval_min_ms + simrnd() % (adv_interval_max_ms - adv_interval_min_ms + 1);
+    events.push({t + interval + (int64_t)(simrnd() % adv_delay_max_ms), ev_adv, n, slot});
+}
+
+// queue text at node n, tracked as a new message. returns the chars sent
+static int send_message(const int64_t t, const int n, const char* text, int len)
+{
+    simnode& sn = nodes[n];
+    int id = (int)msgs.size();
+    msgs.push_back(simmsg{n, t});
+    msgs.back().t_rx.assign(cfg.nodes, -1);
+    msgs.back().hops.assign(cfg.nodes, 0);
+
+    sn.node.tick(sim_minute(t));
+    size_t before = sn.node.srcpackets.size();
+    int sent = sn.node.send_text(text, len);
+    for (size_t p = before; p < sn.node.srcpackets.size(); p++) pakmsg[sn.node.srcpackets[p].pakhash] = id;
+    msgs.back().packets = (int)(sn.node.srcpackets.size() - before);
+    return sent;
+}
+
+static void on_send(const int64_t t, const int64_t t_stop)
+{
+    std::exponential_distribution<double> gap(cfg.msgrate / 60000.0);
+    int n = simrnd() % cfg.nodes;
+
+    // a "#<id> " tag keeps every message's packets distinct
+    char text[apppacket::msg_max + 1];
+    int tag = snprintf(text, sizeof(text), "#%d ", (int)msgs.size());
+    if (corpus.empty()) {
+        int len = tag + snprintf(text + tag, sizeof(text) - tag, "hello");
+        send_message(t, n, text, len);
+    } else {
+        const std::string& line = corpus[corpus_next++ % corpus.size()];
+        int len = tag + snprintf(text + tag, sizeof(text) - tag, "%s", line.c_str());
+        len = std::min(len, (int)sizeof(text) - 1);
+        int sent = send_message(t, n, text, len);
+        msgs.back().chars = std::max(0, sent - tag);
+    }
+
+    int64_t t_next = t + std::max((int64_t)1, (int64_t)gap(simrnd));
+    if (t_next < t_stop) events.push({t_next, ev_send, 0});
+}
+
+static int load_corpus(const char* path)
+{
+    std::ifstream in(path);
+    if (!in) return 1;
+    std::string line;
+    while (std::getline(in, line)) if (!line.empty()) corpus.push_back(line);
+    return corpus.empty() ? 1 : 0;
+}
+
+//////////////////
+
+static double percentile(std::vector<double>& v, double p)
+{
+    if (v.empty()) return 0;
+    size_t i = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+static void report(const int64_t t_end)
+{
+    std::vector<double> latency, hops, hoplatency, ratio, airtime;
+    for (auto& m : msgs) {
+        ratio.push_back(cfg.nodes > 1 ? (double)m.rxcount / (cfg.nodes - 1) : 0);
+        airtime.push_back(m.advs * airtime_per_adv_ms);
+        for (int n = 0; n < cfg.nodes; n++) {
+            if (m.t_rx[n] < 0) continue;
+            latency.push_back((double)m.t_rx[n]);
+            hops.push_back(m.hops[n]);
+            hoplatency.push_back((double)m.t_rx[n] / std::max(1, (int)m.hops[n]));
+        }
+    }
+
+    auto mean = [](const std::vector<double>& v) { double s = 0; for (auto x : v) s += x; return v.empty() ? 0 : s / v.size(); };
+    size_t links = 0;
+    for (auto& sn : nodes) links += sn.neighbours.size();
+
+    printf("nodes %d  mean neighbours %.1f  messages %zu  simulated %.0fs\n", cfg.nodes, (double)links / std::max(1, cfg.nodes), msgs.size(), t_end / 1000.0);
+    printf("delivery ratio       mean %.3f  p5 %.3f  p50 %.3f\n", mean(ratio), percentile(ratio, 0.05), percentile(ratio, 0.5));
+    printf("latency ms           mean %.0f  p50 %.0f  p95 %.0f\n", mean(latency), percentile(latency, 0.5), percentile(latency, 0.95));
+    printf("hops                 mean %.2f  p95 %.0f\n", mean(hops), percentile(hops, 0.95));
+    printf("hop latency ms       mean %.0f  p50 %.0f\n", mean(hoplatency), percentile(hoplatency, 0.5));
+    printf("airtime/message ms   mean %.1f  p95 %.1f  (%.3f ms per adv event)\n", mean(airtime), percentile(airtime, 0.95), airtime_per_adv_ms);
+    if (!corpus.empty()) {
+        double chars = 0, packets = 0, delivered = 0, ms = 0;
+        for (auto& m : msgs) {
+            chars += m.chars;
+            packets += m.packets;
+            delivered += cfg.nodes > 1 ? (double)m.chars * m.rxcount / (cfg.nodes - 1) : 0;
+            ms += m.advs * airtime_per_adv_ms;
+        }
+        printf("text (%s)         %.1f chars/packet  %.2f packets/line  %.4f delivered chars/ms airtime\n", textcoding ? "pack6" : "raw  ",
+            chars / std::max(1.0, packets), packets / std::max((size_t)1, msgs.size()), delivered / std::max(1.0, ms));
+    }
+    double srcsent = 0, srcexpired = 0, srcmissed = 0;
+    for (auto& sn : nodes) { srcsent += sn.node.srcpackets.sent; srcexpired += sn.node.srcpackets.expired; srcmissed += sn.node.srcpackets.missed; }
+    printf("source packets       %.1f%% got their whole budget  %.1f%% expired before going out\n", 100.0 * srcsent / std::max(1.0, srcsent + srcexpired),
+        100.0 * srcmissed / std::max(1.0, srcsent + srcexpired));
+    printf("channel airtime      %.2f%% per node\n", 100.0 * total_advs * airtime_per_adv_ms / std::max(1.0, (double)t_end * cfg.nodes));
+    if (cfg.adaptive) {
+        std::vector<double> copies;
+        double forwarded = 0, suppressed = 0;
+        for (auto& sn : nodes) {
+            copies.push_back(sn.copies_sum / std::max((uint32_t)1, sn.copies_n));
+            forwarded += sn.node.stats.forwarded;
+            suppressed += sn.node.stats.suppressed;
+        }
+        printf("adaptive airtime     copies mean %.2f  p5 %.2f  p95 %.2f  %.1f%% of new packets not forwarded\n", mean(copies),
+            percentile(copies, 0.05), percentile(copies, 0.95), 100.0 * suppressed / std::max(1.0, forwarded + suppressed));
+    }
+}
+
+static void usage()
+{
+    printf("btbsim [options]\n");
+    printf("  -n <nodes>            (%d)\n", cfg.nodes);
+    printf("  -a <area side m>      (%.0f)\n", cfg.area);
+    printf("  -t <seconds>          (%.0f) messages are injected for this long, then the mesh drains\n", cfg.seconds);
+    printf("  -m <msgs per minute>  (%.0f)\n", cfg.msgrate);
+    printf("  -x <rssi at 1m>       (%.0f)\n", cfg.txpower);
+    printf("  -p <pathloss exp>     (%.1f)\n", cfg.pathloss);
+    printf("  -s <shadowing dB>     (%.1f)\n", cfg.shadowing);
+    printf("  -f <fading dB>        (%.1f)\n", cfg.fading);
+    printf("  -S <sensitivity dBm>  (%.0f)\n", cfg.sensitivity);
+    printf("  -l <loss 0..1>        (%.2f)\n", cfg.loss);
+    printf("  -q <mesh queue cap>   (%u)\n", cfg.meshcap);
+    printf("  -e lowest|oldest|none mesh queue eviction\n");
+    printf("  -d <packets/minute>   (%u) duplicate filter sizing\n", cfg.duplpackets);
+    printf("  -F <fp rate>          (%g) duplicate filter false positive rate\n", cfg.duplfpr);
+    printf("  -A <adv sets>         (%d) beacons each advertising radio keeps on the air at once, up to %d\n", cfg.advsets, simradio::max_sets);
+    printf("  -M <roles>            (%s) each node's radios: s scans, a advertises, b does both. eg sa, bb\n", cfg.roles);
+    printf("  -B <0..1>             (%.2f) chance a radio doing both misses a beacon while it is advertising\n", cfg.busy);
+    printf("  -b <picks>            (%d) beacon picks each source packet gets\n", cfg.srcbudget);
+    printf("  -o <0..1>             (%.2f) share of beacon picks for source packets while there are mesh packets too\n", cfg.srcshare);
+    printf("  -w                    adaptive airtime: mesh holds, forwarding and jitter follow each node's density estimate\n");
+    printf("  -C <corpus file>      chat lines to send, one per line, fragmented as needed\n");
+    printf("  -T <0|1>              (%d) pack6 text coding for text that doesn't fit raw\n", textcoding);
+    printf("  -r <seed>             (%u)\n", cfg.seed);
+    printf("  -v <debugmode>\n");
+}
+
+int main(int argc, char* argv[]) {
+    debugmode = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:a:t:m:x:p:s:f:S:l:q:e:d:F:A:M:B:b:o:C:T:r:v:wh")) != -1) {
+        switch (opt) {
+            case 'n': cfg.nodes = std::max(1, atoi(optarg)); break;
+            case 'a': cfg.area = atof(optarg); break;
+            case 't': cfg.seconds = atof(optarg); break;
+            case 'm': cfg.msgrate = atof(optarg); break;
+            case 'x': cfg.txpower = atof(optarg); break;
+            case 'p': cfg.pathloss = atof(optarg); break;
+            case 's': cfg.shadowing = atof(optarg); break;
+            case 'f': cfg.fading = atof(optarg); break;
+            case 'S': cfg.sensitivity = atof(optarg); break;
+            case 'l': cfg.loss = atof(optarg); break;
+            case 'q': cfg.meshcap = std::max(1, atoi(optarg)); break;
+            case 'e': if ((cfg.meshpolicy = meshstore::policy_of(optarg)) < 0) { usage(); return 1; } break;
+            case 'd': cfg.duplpackets = std::max(1, atoi(optarg)); break;
+            case 'F': cfg.duplfpr = atof(optarg); break;
+            case 'A': cfg.advsets = std::min(std::max(1, atoi(optarg)), simradio::max_sets); break;
+            case 'M': cfg.roles = optarg; break;
+            case 'B': cfg.busy = atof(optarg); break;
+            case 'b': cfg.srcbudget = std::min(std::max(1, atoi(optarg)), 255); break;
+            case 'o': cfg.srcshare = std::min(std::max(0.0, atof(optarg)), 1.0); break;
+            case 'w': cfg.adaptive = true; break;
+            case 'C': cfg.corpus = optarg; break;
+            case 'T': textcoding = atoi(optarg); break;
+            case 'r': cfg.seed = (unsigned)atoi(optarg); break;
+            case 'v': debugmode = atoi(optarg); break;
+            default: usage(); return 1;
+        }
+    }
+
+    if (!*cfg.roles || strspn(cfg.roles, "sab") != strlen(cfg.roles) || strlen(cfg.roles) > multiradio::max_radios) { usage(); return 1; }
+    if (!strpbrk(cfg.roles, "sb") || !strpbrk(cfg.roles, "ab")) { printf("A node needs a radio that scans and one that advertises\n"); return 1; }
+    if (cfg.corpus && load_corpus(cfg.corpus)) { printf("Can't read corpus %s\n", cfg.corpus); return 1; }
+
+    simrnd.seed(cfg.seed);
+    rnd.seed(cfg.seed);
+
+    place_nodes();
+
+    // packets live for the current and previous minute, so let the mesh drain for two more after the last send
+    const int64_t t_stop = (int64_t)(cfg.seconds * 1000);
+    const int64_t t_end = t_stop + 2 * 60000;
+
+    for (int n = 0; n < cfg.nodes; n++)
+        for (int s = 0; s < nodes[n].radio.beacon_slots(); s++) events.push({(int64_t)(simrnd() % TO_1SEC), ev_timer, n, s});
+    if (cfg.msgrate > 0) events.push({0, ev_send, 0});
+
+    while (!events.empty() && events.top().t < t_end) {
+        simevent e = events.top();
+        events.pop();
+        switch (e.type) {
+            case ev_timer: on_timer(e.t, e.node, e.slot); break;
+            case ev_adv: on_adv(e.t, e.node, e.slot); break;
+            case ev_send: on_send(e.t, t_stop); break;
+        }
+    }
+
+    report(t_end);
+    return 0;
+}
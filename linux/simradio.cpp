@@ -0,0 +1,51 @@
+#include <cstring>
+#include <algorithm>
+
+#include "simradio.h"
+
+int simradio::read(uint8_t* buf, size_t bufsize)
+{
+    if (inbox.empty()) return 0;
+    memset(buf, 0, bufsize);
+    int count = (int)std::min(bufsize, (size_t)(inbox.front()[2] + 3)); // +3 for pkt type, evt code and len
+    memcpy(buf, inbox.front().data(), count);
+    inbox.pop_front();
+    return count;
+}
+
+int simradio::set_beacon(const int slot, const uint8_t* advbuf, uint8_t len)
+{
+    if (slot < 0 || slot >= nsets) return 1;
+    advset& s = sets[slot];
+    s.len = std::min(len, (uint8_t)sizeof(s.beacon));
+    memcpy(s.beacon, advbuf, s.len);
+    s.advertising = true;
+    return 0;
+}
+
+int simradio::stop_beacon(const int slot)
+{
+    if (slot < 0 || slot >= nsets) return 1;
+    sets[slot].advertising = false;
+    return 0;
+}
+
+void simradio::hear(const uint8_t* advbuf, const uint8_t* addr, int8_t rssi)
+{
+    // synthesize an le meta advertising report, laid out as parse_network expects:
+    // <04> <3e> <plen> <02> <nreports> <evt type> <addr type> <addr x6> <data len> <data...> <rssi>
+    uint8_t datalen = std::min(advbuf[0], (uint8_t)31);
+    frame f = {0};
+    f[0] = 0x04; // hci event
+    f[1] = 0x3E; // le meta
+    f[2] = (uint8_t)(12 + datalen); // subevent, nreports, type, addr type, addr x6, data len, data, rssi
+    f[3] = 0x02; // advertising report
+    f[4] = 1;
+    f[5] = 0x03; // ADV_NONCONN_IND
+    f[6] = 0x00; // public
+    memcpy(&f[7], addr, 6);
+    f[13] = datalen;
+    memcpy(&f[14], advbuf + 1, datalen);
+    f[14 + datalen] = (uint8_t)rssi;
+    inbox.push_back(f);
+}
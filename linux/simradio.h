@@ -0,0 +1,39 @@
+#ifndef SIMRADIO_H
+#define SIMRADIO_H
+
+#include <array>
+#include <deque>
+
+#include "radio.h"
+
+// an in-process controller. the simulated medium calls hear() with other radios' beacons and
+// the app reads them back as the same le advertising report events a real controller would produce.
+struct simradio: public radio {
+    static constexpr int frame_size = 48;
+    typedef std::array<uint8_t, frame_size> frame;
+
+    static constexpr int max_sets = 8;
+
+    // one advertising set, as an extended advertising controller would have several of
+    struct advset {
+        uint8_t beacon[32] = {0};
+        uint8_t len = 0;
+        bool advertising = false;
+    };
+
+    uint8_t bdaddr[6] = {0};
+    int nsets = 1; // 1 is a legacy controller
+    advset sets[max_sets];
+    std::deque<frame> inbox;
+
+    int fd() const override { return -1; }
+    int read(uint8_t* buf, size_t bufsize) override;
+    int beacon_slots() const override { return nsets; }
+    int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) override;
+    int stop_beacon(const int slot) override;
+
+    // medium side: another radio's beacon arrived with the given rssi
+    void hear(const uint8_t* advbuf, const uint8_t* addr, int8_t rssi);
+};
+
+#endif //SIMRADIO_H
@@ -0,0 +1,32 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstdint>
+
+// a bounded single-producer single-consumer ring of fixed-size slots, lock-free.
+// the producer fills back() in place and push()es it, the consumer reads front() in place and pop()s it,
+// so nothing is copied or allocated per item. N must be a power of two.
+template<class T, uint32_t N>
+struct spscring {
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+    // producer side
+    bool full() const { return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == N; }
+    T& back() { return slots[tail.load(std::memory_order_relaxed) & (N - 1)]; }
+    void push() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // consumer side
+    bool empty() const { return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire); }
+    T& front() { return slots[head.load(std::memory_order_relaxed) & (N - 1)]; }
+    void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    uint32_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<uint32_t> head{0}; // next to read, written by the consumer
+    alignas(64) std::atomic<uint32_t> tail{0}; // next to write, written by the producer
+    alignas(64) T slots[N];
+};
+
+#endif //SPSCRING_H
@@ -0,0 +1,41 @@
+#include <algorithm>
+
+#include "srcqueue.h"
+
+void srcqueue::expire(const uint8_t m)
+{
+    size_t before = q.size();
+    q.erase(std::remove_if(q.begin(), q.end(), [this, m](const srcpacket& p) {
+        if (p.valid_minute(m)) return false;
+        if (p.left == budget) missed++;
+        return true;
+    }), q.end());
+    if (q.size() == before) return;
+    statusmessage("Skipping expired packet")
+    expired += (uint32_t)(before - q.size());
+}
+
+bool srcqueue::pick(txablepacket& packet, const uint8_t m, const uint slot)
+{
+    expire(m);
+    if (slot >= q.size()) return false;
+
+    // the run at the front stamped with the oldest minute is due soonest. a slot past it takes turns over the lot
+    size_t run = 1;
+    while (run < q.size() && q[run].minute() == q.front().minute()) run++;
+    if (slot >= run) run = q.size();
+
+    for (size_t tries = 0; tries < run; tries++) {
+        size_t i = next++ % run;
+        if (q[i].slot >= 0) continue; // on another slot
+        packet = q[i];
+        q[i].slot = (int8_t)slot;
+        if (--q[i].left == 0) {
+            q.erase(q.begin() + i);
+            next = (uint32_t)i; // the packet after it has moved up
+            sent++;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,49 @@
+#ifndef SRCQUEUE_H
+#define SRCQUEUE_H
+
+#include <cstdint>
+#include <deque>
+
+#include "btbcore.h"
+
+// a packet we are the source for, and the picks it has left
+struct srcpacket: public txablepacket {
+    srcpacket(const apppacket& ap, const int xt, const uint8_t picks) : txablepacket(ap, xt), left(picks) {}
+    uint8_t left;
+    int8_t slot = -1; // the beacon slot it is on the air in, -1 for none
+};
+
+// our own packets waiting for air. each is picked budget times, after which neighbours have heard it
+// and it's left to the mesh. packets are served earliest deadline first: a packet is valid for the
+// minute it was stamped and the next, so those stamped before the current minute, at the front, go
+// before any newer ones. packets due together take turns, so several messages, and the fragments of
+// each, interleave.
+struct srcqueue {
+    uint8_t budget = 3; // picks per packet
+    std::deque<srcpacket> q; // in the order queued, which is deadline order
+    uint32_t next = 0; // round robin over the packets due soonest
+    uint32_t sent = 0; // picked their whole budget
+    uint32_t expired = 0; // dropped with picks left
+    uint32_t missed = 0; // of those, never picked at all
+
+    bool empty() const { return q.empty(); }
+    size_t size() const { return q.size(); }
+    const srcpacket& operator[](const size_t i) const { return q[i]; }
+
+    void push(const apppacket& ap, const int xtime) { q.emplace_back(ap, xtime, budget); }
+
+    // true when the front packet is in its last valid minute
+    bool due(const uint8_t m) const { return !q.empty() && q.front().minute() != m; }
+
+    // the next packet for a beacon slot. a slot only gets one when there are enough to go round, and
+    // packets on the air in another slot are skipped, so slots don't carry the same packet at once
+    bool pick(txablepacket& packet, const uint8_t m, const uint slot = 0);
+
+    // the slot is taking a new beacon, so whatever it carried is off the air
+    void release(const uint slot) { for (auto& p : q) if (p.slot == (int)slot) p.slot = -1; }
+
+    // drop every packet that is no longer valid at minute m
+    void expire(const uint8_t m);
+};
+
+#endif //SRCQUEUE_H
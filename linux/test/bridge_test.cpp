@@ -0,0 +1,155 @@
+// the host bridge end to end: a sender's beacons as scan records, through bridge_receive, to messages
+
+#include <cstring>
+
+#include "btbbridge.h"
+#include "check.h"
+
+static const uint8_t priv = 7;
+static const uint8_t minute = 5;
+static const int8_t rssi = -40;
+static const char* short_text = "hello there";
+static const char* long_text = "a message much too long for one packet, so it goes out as several fragments";
+
+struct records {
+    uint8_t buf[4096];
+    size_t len = 0;
+    int count = 0;
+};
+
+// queue texts on a sender and turn every beacon it picks into a scan record, as the host's scanner would
+static void beacons(records& r, const char* const* texts, const int ntexts)
+{
+    btbnode sender;
+    sender.privcode = priv;
+    sender.tick(minute);
+    for (int i = 0; i < ntexts; i++) sender.send_text(texts[i], (int)strlen(texts[i]));
+
+    // the flags and manufacturer header are fixed, bridge_pick hands back what follows them
+    uint8_t adv[apppacket::adv_size];
+    apppacket().build_beacon(adv, sender.mfgcode);
+    const uint8_t addr[6] = {1, 2, 3, 4, 5, 6};
+    uint8_t payload[bridge_payload_size];
+    while (bridge_pick(sender, minute, payload) && r.len + bridge_record_max <= sizeof(r.buf)) {
+        memcpy(adv + apppacket::adv_size - bridge_payload_size, payload, bridge_payload_size);
+        r.len += bridge_record(r.buf + r.len, adv + 1, adv[0], addr, rssi);
+        r.count++;
+    }
+}
+
+// the messages in out, checked for privcode and rssi. returns how many matched text
+static int messages(const uint8_t* out, const size_t outlen, const char* text)
+{
+    int found = 0;
+    size_t pos = 0;
+    while (pos + 4 <= outlen) {
+        size_t len = get_le16(out + pos);
+        check(pos + 4 + len <= outlen);
+        check(out[pos + 2] == priv);
+        check((int8_t)out[pos + 3] == rssi);
+        if (len == strlen(text) && memcmp(out + pos + 4, text, len) == 0) found++;
+        pos += 4 + len;
+    }
+    check(pos == outlen);
+    return found;
+}
+
+static btbnode receiver()
+{
+    btbnode node;
+    node.privcode = priv;
+    node.tick(minute);
+    return node;
+}
+
+int main()
+{
+    static uint8_t out[4 * bridge_message_max];
+    size_t outlen = 0;
+
+    // one short message, picked a few times: decoded once, the repeats are duplicates
+    {
+        records r;
+        beacons(r, &short_text, 1);
+        check(r.count > 1);
+        btbnode node = receiver();
+        check(bridge_receive(node, r.buf, r.len, out, sizeof(out), outlen) == r.len);
+        check(outlen == 4 + strlen(short_text));
+        check(messages(out, outlen, short_text) == 1);
+        check(node.stats.rx[rx_duplicate] == (uint64_t)r.count - 1);
+    }
+
+    // a fragmented message comes out once, whole, when its last fragment arrives
+    {
+        records r;
+        beacons(r, &long_text, 1);
+        btbnode node = receiver();
+        check(bridge_receive(node, r.buf, r.len, out, sizeof(out), outlen) == r.len);
+        check(messages(out, outlen, long_text) == 1);
+        check(outlen == 4 + strlen(long_text));
+        check(node.stats.rx[rx_partial] > 0);
+    }
+
+    // with room for a single message, the batch stops after the record completing it and the rest follows
+    {
+        const char* both[] = {short_text, long_text};
+        records r;
+        beacons(r, both, 2);
+        btbnode node = receiver();
+        size_t used = bridge_receive(node, r.buf, r.len, out, bridge_message_max, outlen);
+        check(used > 0 && used < r.len);
+        check(outlen > 0);
+        int first = messages(out, outlen, short_text) + messages(out, outlen, long_text);
+        check(first == 1);
+        size_t rest = bridge_receive(node, r.buf + used, r.len - used, out, sizeof(out), outlen);
+        check(used + rest == r.len);
+        check(first + messages(out, outlen, short_text) + messages(out, outlen, long_text) == 2);
+
+        // and with no room at all nothing is consumed
+        btbnode again = receiver();
+        check(bridge_receive(again, r.buf, r.len, out, bridge_message_max - 1, outlen) == 0);
+        check(outlen == 0);
+    }
+
+    // malformed and short records stop the batch where they start
+    {
+        records r;
+        beacons(r, &short_text, 1);
+        const size_t one = 8 + r.buf[0];
+        btbnode node = receiver();
+
+        check(bridge_receive(node, r.buf, 7, out, sizeof(out), outlen) == 0); // short of a header
+        check(bridge_receive(node, r.buf, one - 1, out, sizeof(out), outlen) == 0); // short of its data
+        check(outlen == 0);
+
+        uint8_t bad[64];
+        memcpy(bad, r.buf, one);
+        bad[0] = 32; // longer than any advertisement
+        check(bridge_receive(node, bad, sizeof(bad), out, sizeof(out), outlen) == 0);
+        check(outlen == 0);
+
+        // a good record, then a truncated one: only the first is consumed
+        check(bridge_receive(node, r.buf, one + 5, out, sizeof(out), outlen) == one);
+        check(messages(out, outlen, short_text) == 1);
+    }
+
+    // records that frame correctly but aren't ours, or aren't beacons, are consumed without output
+    {
+        records r;
+        beacons(r, &short_text, 1);
+        const size_t one = 8 + r.buf[0];
+        uint8_t in[3 * bridge_record_max];
+        memcpy(in, r.buf, one);
+        in[8 + 5] ^= 0xFF; // the mfgcode, after the flags and <len> <ff>
+        memset(in + one, 0xFF, 8 + 31);
+        in[one] = 31;
+        memset(in + one + 8 + 31, 0, 8); // an empty advertisement
+        const size_t inlen = one + 8 + 31 + 8;
+        btbnode node = receiver();
+        check(bridge_receive(node, in, inlen, out, sizeof(out), outlen) == inlen);
+        check(outlen == 0);
+    }
+
+    printf("bridge_test: %d failures\n", check_failures);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+// just enough of a test harness for ctest: a failed check prints where and counts, main returns the count
+static int check_failures = 0;
+
+#define check(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); check_failures++; } } while(false)
+
+#endif //CHECK_H
@@ -0,0 +1,96 @@
+// parse_network on advertising reports whose lengths, all of which come over the air, are wrong
+
+#include <cstring>
+
+#include "btbcore.h"
+#include "check.h"
+
+// a legacy report around advertising data, in a 256 byte buffer as the receive path reads into
+static void report(uint8_t* f, const uint8_t* data, const uint8_t len)
+{
+    memset(f, 0, 256);
+    f[0] = hci_pkt_event;
+    f[1] = hci_evt_le_meta;
+    f[2] = (uint8_t)(12 + len);
+    f[3] = hci_le_adv_report;
+    f[4] = 1;
+    f[13] = len;
+    memcpy(f + 14, data, len);
+    f[14 + len] = (uint8_t)-60;
+}
+
+int main()
+{
+    const uint16_t mfgcode = 0x1122;
+    uint8_t f[256];
+    apppacket sent, got;
+    sent.parse_text(0x5A, 7, "hello", 5);
+    uint8_t adv[apppacket::adv_size];
+    sent.build_beacon(adv, mfgcode);
+    const uint8_t len = adv[0]; // data after the length byte
+
+    // as sent, with the flags structure and without, as android sends them
+    report(f, adv + 1, len);
+    check(got.parse_network(f, mfgcode) == 0);
+    check(memcmp(got.pakdat, sent.pakdat, sizeof(sent.pakdat)) == 0);
+    check(got.rxrssi == -60);
+    report(f, adv + 4, len - 3);
+    check(got.parse_network(f, mfgcode) == 0);
+    check(memcmp(got.pakdat, sent.pakdat, sizeof(sent.pakdat)) == 0);
+    check(got.parse_network(f, 0x3344) == 1);
+
+    // a data length past the end of the event
+    report(f, adv + 1, len);
+    f[2] = 12;
+    check(got.parse_network(f, mfgcode) == 1);
+    report(f, adv + 1, len);
+    f[13] = 255;
+    check(got.parse_network(f, mfgcode) == 1);
+
+    // a flags structure longer than the data, or one that swallows all of it
+    uint8_t d[31];
+    memcpy(d, adv + 1, len);
+    d[0] = 0xFF;
+    report(f, d, len);
+    check(got.parse_network(f, mfgcode) == 1);
+    d[0] = (uint8_t)(len - 1);
+    report(f, d, len);
+    check(got.parse_network(f, mfgcode) == 1);
+
+    // a manufacturer structure too short for its header, with a beacon code that would match. it used to wrap
+    memcpy(d, adv + 1, len);
+    for (uint8_t n = 0; n < 5; n++) {
+        d[3] = n;
+        report(f, d, len);
+        check(got.parse_network(f, mfgcode) == 1);
+    }
+
+    // one longer than the data, and one cut off by the data length
+    d[3] = 0xFF;
+    report(f, d, len);
+    check(got.parse_network(f, mfgcode) == 1);
+    memcpy(d, adv + 1, len);
+    report(f, d, 8);
+    check(got.parse_network(f, mfgcode) == 1);
+
+    // shorter than a whole packet but well formed: what fits is taken, the rest is zero
+    memcpy(d, adv + 1, len);
+    d[3] = 5 + 4;
+    report(f, d, 3 + 1 + d[3]);
+    check(got.parse_network(f, mfgcode) == 0);
+    check(memcmp(got.pakdat, sent.pakdat, 4) == 0 && got.pakdat[4] == 0);
+    check(got.rssi == 0);
+
+    // every data length and flags length over a buffer that's all 0x01, for anything reading outside the report
+    for (int dl = 0; dl <= 31; dl++) {
+        for (int fl = 0; fl < 256; fl += 15) {
+            memset(d, 0x01, sizeof(d));
+            d[0] = (uint8_t)fl;
+            report(f, d, (uint8_t)dl);
+            got.parse_network(f, mfgcode);
+        }
+    }
+
+    printf("parse_test: %d failures\n", check_failures);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+// spscring with a producer and a consumer thread: every item arrives, once, in order, whole
+
+#include <thread>
+
+#include "spscring.h"
+#include "check.h"
+
+// several words, so a slot read while it is still being written shows up as a mismatch
+struct item {
+    uint32_t seq;
+    uint32_t words[6];
+};
+
+static uint32_t word(const uint32_t seq, const int i) { return seq * 2654435761u + (uint32_t)i; }
+
+// a small ring wraps its slots every few items. the producer spins when full and the consumer when empty,
+// both now and then yielding so the threads also meet at other points in the ring
+template<uint32_t N>
+static void stress(const uint32_t count)
+{
+    spscring<item, N> ring;
+    std::thread producer([&ring, count] {
+        for (uint32_t seq = 0; seq < count; seq++) {
+            while (ring.full()) std::this_thread::yield();
+            item& it = ring.back();
+            it.seq = seq;
+            for (int i = 0; i < 6; i++) it.words[i] = word(seq, i);
+            ring.push();
+            if (seq % 4099 == 0) std::this_thread::yield();
+        }
+    });
+
+    uint32_t expect = 0, lost = 0, torn = 0, over = 0;
+    while (expect < count) {
+        while (ring.empty()) std::this_thread::yield();
+        if (ring.size() > N) over++;
+        const item& it = ring.front();
+        if (it.seq != expect) lost++;
+        for (int i = 0; i < 6; i++) if (it.words[i] != word(it.seq, i)) torn++;
+        expect = it.seq + 1;
+        ring.pop();
+        if (expect % 3001 == 0) std::this_thread::yield();
+    }
+    producer.join();
+
+    check(lost == 0);
+    check(torn == 0);
+    check(over == 0);
+    check(ring.empty());
+}
+
+int main()
+{
+    // one thread: full exactly at N, empty after N pops, around the ring several times
+    spscring<uint32_t, 4> small;
+    for (uint32_t round = 0; round < 5; round++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            check(!small.full());
+            small.back() = round * 4 + i;
+            small.push();
+        }
+        check(small.full());
+        check(small.size() == 4);
+        for (uint32_t i = 0; i < 4; i++) {
+            check(!small.empty());
+            check(small.front() == round * 4 + i);
+            small.pop();
+        }
+        check(small.empty());
+    }
+
+    stress<2>(200000);
+    stress<8>(1000000);
+    stress<256>(2000000);
+
+    printf("spscring_test: %d failures\n", check_failures);
+    return check_failures ? 1 : 0;
+}
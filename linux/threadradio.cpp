@@ -0,0 +1,137 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "btbcore.h"
+#include "threadradio.h"
+
+static inline void efd_signal(int efd) { uint64_t one = 1; ::write(efd, &one, sizeof(one)); }
+static inline void efd_clear(int efd) { uint64_t n; ::read(efd, &n, sizeof(n)); }
+
+int threadradio::open(radio* device)
+{
+    do {
+        dev = device;
+        rx_done = false;
+        if ((rx_efd = eventfd(0, EFD_NONBLOCK)) < 0) failmessage_break("Can't create receive eventfd")
+        if ((tx_efd = eventfd(0, EFD_NONBLOCK)) < 0) failmessage_break("Can't create command eventfd")
+        if ((stop_efd = eventfd(0, EFD_NONBLOCK)) < 0) failmessage_break("Can't create stop eventfd")
+        if ((space_efd = eventfd(0, EFD_NONBLOCK)) < 0) failmessage_break("Can't create space eventfd")
+        rx_thread = std::thread(&threadradio::rx_loop, this);
+        tx_thread = std::thread(&threadradio::tx_loop, this);
+        return 0;
+    } while(false);
+    close();
+    return 1;
+}
+
+void threadradio::close()
+{
+    if (stop_efd >= 0) efd_signal(stop_efd);
+    if (rx_thread.joinable()) rx_thread.join();
+    if (tx_thread.joinable()) tx_thread.join();
+    for (int* fd : {&rx_efd, &tx_efd, &stop_efd, &space_efd}) {
+        if (*fd >= 0) ::close(*fd);
+        *fd = -1;
+    }
+}
+
+void threadradio::rx_loop()
+{
+    struct pollfd pollgroup[2] = {{.fd = stop_efd, .events = POLLIN}, {.fd = dev->fd(), .events = POLLIN}};
+    struct pollfd waitgroup[2] = {{.fd = stop_efd, .events = POLLIN}, {.fd = space_efd, .events = POLLIN}};
+    while (!rx_done) {
+        if (poll(pollgroup, 2, -1) < 0 && errno != EINTR) { rx_done = true; break; }
+        if (pollgroup[0].revents) break;
+
+        // drain the device, passing frames on every so often during a long burst
+        uint32_t n = 0;
+        while (true) {
+            if (rxq.full()) {
+                rx_full++;
+                efd_signal(rx_efd);
+                // say we're asleep, then look again, so a pop in between either is seen here or signals
+                while (true) {
+                    rx_waiting = true;
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!rxq.full()) { rx_waiting = false; break; }
+                    if (poll(waitgroup, 2, -1) < 0 && errno != EINTR) { rx_done = true; return; }
+                    if (waitgroup[0].revents) return;
+                    efd_clear(space_efd);
+                }
+            }
+            hciring::frame& f = rxq.back();
+            int count = dev->read(f.data, sizeof(f.data));
+            if (count < 0) { rx_done = true; break; }
+            if (count == 0) break;
+            f.len = (uint16_t)count;
+            rxq.push();
+            rx_frames++;
+            if (++n % 32 == 0) efd_signal(rx_efd);
+        }
+        if (n || rx_done) efd_signal(rx_efd);
+    }
+}
+
+void threadradio::tx_loop()
+{
+    struct pollfd pollgroup[2] = {{.fd = stop_efd, .events = POLLIN}, {.fd = tx_efd, .events = POLLIN}};
+    while (true) {
+        if (poll(pollgroup, 2, -1) < 0 && errno != EINTR) break;
+        if (pollgroup[0].revents) break;
+        efd_clear(tx_efd);
+        for (; !txq.empty(); txq.pop()) {
+            beaconcmd& cmd = txq.front();
+            int fail = cmd.len ? dev->set_beacon(cmd.slot, cmd.advbuf, cmd.len) : dev->stop_beacon(cmd.slot);
+            if (fail) tx_fail++;
+        }
+    }
+}
+
+int threadradio::read(uint8_t* buf, size_t bufsize)
+{
+    // a push is always followed by a signal, so clearing the wakeup before looking can't lose one.
+    // the fd must stay readable while frames are queued: a caller may stop short of draining the ring,
+    // so if the clear swallowed the signal for a frame that just arrived, put it back. likewise once the
+    // receive thread is done, so the error is seen again after a batch that ended on it
+    bool done = rx_done;
+    if (rxq.empty()) {
+        efd_clear(rx_efd);
+        if (rxq.empty() && !done) return 0;
+        efd_signal(rx_efd);
+        if (rxq.empty()) return -1;
+    }
+    hciring::frame& f = rxq.front();
+    int count = (int)std::min(bufsize, (size_t)f.len);
+    memcpy(buf, f.data, count);
+    rxq.pop();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rx_waiting.load(std::memory_order_relaxed) && rx_waiting.exchange(false)) efd_signal(space_efd);
+    return count;
+}
+
+int threadradio::set_beacon(const int slot, const uint8_t* advbuf, uint8_t len)
+{
+    if (txq.full()) { tx_full++; return 0; }
+    beaconcmd& cmd = txq.back();
+    cmd.slot = slot;
+    cmd.len = std::min(len, (uint8_t)sizeof(cmd.advbuf));
+    memcpy(cmd.advbuf, advbuf, cmd.len);
+    txq.push();
+    efd_signal(tx_efd);
+    return 0;
+}
+
+int threadradio::stop_beacon(const int slot)
+{
+    if (txq.full()) { tx_full++; return 0; }
+    beaconcmd& cmd = txq.back();
+    cmd.slot = slot;
+    cmd.len = 0;
+    txq.push();
+    efd_signal(tx_efd);
+    return 0;
+}
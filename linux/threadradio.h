@@ -0,0 +1,60 @@
+#ifndef THREADRADIO_H
+#define THREADRADIO_H
+
+#include <atomic>
+#include <thread>
+
+#include "radio.h"
+#include "spscring.h"
+
+// threaded mode. wraps a radio with a receive thread and an hci command thread, joined to the
+// protocol thread (whoever uses this radio) by lock-free spsc rings of fixed-size frames:
+//   device -> receive thread -> rxq -> protocol thread -> txq -> command thread -> device
+// when rxq is full the receive thread sleeps rather than dropping, leaving the backlog in the socket,
+// until the protocol thread takes a frame.
+struct threadradio: public radio {
+    // a beacon change for the command thread. len 0 takes the slot's beacon down
+    struct beaconcmd {
+        int slot;
+        uint8_t len;
+        uint8_t advbuf[32];
+    };
+
+    static constexpr uint32_t rxq_size = 1024;
+    static constexpr uint32_t txq_size = 64;
+
+    radio* dev = nullptr;
+    spscring<hciring::frame, rxq_size> rxq;
+    spscring<beaconcmd, txq_size> txq;
+    int rx_efd = -1; // readable while rxq has frames
+    int tx_efd = -1; // wakes the command thread
+    int stop_efd = -1; // wakes both threads to exit
+    int space_efd = -1; // wakes the receive thread once rxq has room
+    std::atomic<bool> rx_waiting{false}; // the receive thread is asleep on a full rxq
+    std::thread rx_thread;
+    std::thread tx_thread;
+    std::atomic<bool> rx_done{false}; // device failed or finished, rxq holds what's left
+
+    // counters
+    std::atomic<uint64_t> rx_frames{0};
+    std::atomic<uint64_t> rx_full{0}; // times the receive thread found rxq full and slept
+    uint64_t tx_full = 0; // beacon changes skipped because txq was full, the next rotation retries
+    std::atomic<uint64_t> tx_fail{0};
+
+    ~threadradio() override { close(); }
+
+    int open(radio* device);
+    void close();
+
+    int fd() const override { return rx_efd; }
+    int read(uint8_t* buf, size_t bufsize) override;
+    int beacon_slots() const override { return dev ? dev->beacon_slots() : 1; }
+    int set_beacon(const int slot, const uint8_t* advbuf, uint8_t len) override;
+    int stop_beacon(const int slot) override;
+
+private:
+    void rx_loop();
+    void tx_loop();
+};
+
+#endif //THREADRADIO_H